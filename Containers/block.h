@@ -1,92 +1,317 @@
-#ifndef LABA3_BLOCK_H
-#define LABA3_BLOCK_H
-
-#include "list_stack.h"
-
-#include <cstdint>
-#include <cstring>
-#include <utility>
-
-template< typename T >
-class BlockNode;
-
-template< typename T >
-struct Node
-{
-	Node* prev = nullptr;
-	Node* next = nullptr;
-	BlockNode< T >* block_ptr = nullptr;
-	T* data = nullptr;
-
-	Node() = default;
-
-	void link(Node* other)
-	{
-		this->next = other;
-		other->prev = this;
-	}
-
-	void set_block(BlockNode< T >* block) { block_ptr = block; }
-
-	void set_data(T&& node_data)
-	{
-		if (data)
-		{
-			*data = std::move(node_data);
-		}
-		else
-		{
-			data = new T(std::move(node_data));
-		}
-	}
-	void set_data(const T& node_data)
-	{
-		if (data)
-		{
-			*data = node_data;
-		}
-		else
-		{
-			data = new T(node_data);
-		}
-	}
-	~Node()
-	{
-		delete data;
-		data = nullptr;
-	}
-};
-
-template< typename T >
-struct BlockNode
-{
-	size_t block_size;
-	size_t block_capacity;
-	Node< T >* data;
-	Stack_list< Node< T >* > stack_element;
-	BlockNode< T >* next;
-
-	BlockNode(size_t block_capacity) :
-		block_size(0), block_capacity(block_capacity), data(new Node< T >[block_capacity]), next(nullptr)
-	{
-		for (size_t i = 0; i < block_capacity; ++i)
-		{
-			data[i].set_block(this);
-			stack_element.push(&data[i]);
-		}
-	}
-
-	void destroy_data()
-	{
-		for (size_t i = 0; i < block_capacity; ++i)
-		{
-			data[i].~Node();
-		}
-		delete[] data;
-		data = nullptr;
-	}
-
-	~BlockNode() { destroy_data(); }
-};
-
-#endif	  // LABA3_BLOCK_H
+#ifndef LABA3_BLOCK_H
+#define LABA3_BLOCK_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template< typename T >
+struct BlockHeader;
+
+template< typename T >
+struct Node;
+
+// The part of a node the list itself needs; a storage's end() sentinel is only this, marked by end_position.
+template< typename T >
+struct NodeLinks
+{
+	static constexpr uint32_t end_position = UINT32_MAX;
+
+	NodeLinks* prev = nullptr;
+	NodeLinks* next = nullptr;
+	uint32_t position = 0;
+
+	void link(NodeLinks* other) noexcept
+	{
+		next = other;
+		other->prev = this;
+	}
+};
+
+template< typename T >
+struct Node : NodeLinks< T >
+{
+	using NodeLinks< T >::prev;
+	using NodeLinks< T >::next;
+	using NodeLinks< T >::position;
+
+	uint64_t generation = 0;
+	alignas(T) unsigned char storage[sizeof(T)];
+
+	Node() = default;
+	Node(const Node&) = delete;
+	Node& operator=(const Node&) = delete;
+
+	// Only for links that belong to a slot, never for a storage's sentinel.
+	static Node* from(NodeLinks< T >* links) noexcept { return static_cast< Node* >(links); }
+	static const Node* from(const NodeLinks< T >* links) noexcept { return static_cast< const Node* >(links); }
+
+	BlockHeader< std::remove_const_t< T > >* block_ptr() const noexcept
+	{
+		using header = BlockHeader< std::remove_const_t< T > >;
+		const unsigned char* slots = reinterpret_cast< const unsigned char* >(this - position);
+		return reinterpret_cast< header* >(const_cast< unsigned char* >(slots - header::slots_offset()));
+	}
+
+	T* data() noexcept { return std::launder(reinterpret_cast< T* >(storage)); }
+	const T* data() const noexcept { return std::launder(reinterpret_cast< const T* >(storage)); }
+
+	template< typename... Args >
+	void set_data(Args&&... args)
+	{
+		::new (static_cast< void* >(storage)) T(std::forward< Args >(args)...);
+	}
+
+	void destroy_data() noexcept
+	{
+		if constexpr (!std::is_trivially_destructible_v< T >)
+		{
+			data()->~T();
+		}
+	}
+};
+
+inline constexpr size_t cache_line_size = 64;
+
+template< size_t Alignment >
+struct alignas(Alignment) aligned_chunk
+{
+	unsigned char bytes[Alignment];
+};
+
+// Fields shared by every block layout; a node finds its block through them without knowing the block capacity.
+template< typename T >
+struct alignas(cache_line_size) BlockHeader
+{
+	Node< T >* free_slots;
+	Node< T >* first_node;
+	Node< T >* last_node;
+	BlockHeader< T >* next_free;
+	uint32_t block_size;
+	uint32_t constructed;
+	uint32_t index;
+	uint32_t id;
+	uint32_t mapped;
+	std::atomic< uint32_t > references;
+
+	static constexpr size_t slots_offset()
+	{
+		return (sizeof(BlockHeader) + alignof(Node< T >) - 1) / alignof(Node< T >) * alignof(Node< T >);
+	}
+
+	BlockHeader(const BlockHeader&) = delete;
+	BlockHeader& operator=(const BlockHeader&) = delete;
+
+  protected:
+	BlockHeader() :
+		free_slots(nullptr), first_node(nullptr), last_node(nullptr), next_free(nullptr), block_size(0), constructed(0),
+		index(0), id(0), mapped(0), references(1)
+	{
+	}
+	~BlockHeader() = default;
+};
+
+// A block of a fixed capacity has it as a constant; otherwise each block records its own.
+template< size_t Capacity >
+struct block_capacity_field
+{
+	static constexpr uint32_t block_capacity = Capacity;
+
+	explicit block_capacity_field(size_t) noexcept {}
+};
+
+template<>
+struct block_capacity_field< 0 >
+{
+	uint32_t block_capacity;
+
+	explicit block_capacity_field(size_t block_capacity) noexcept :
+		block_capacity(static_cast< uint32_t >(block_capacity))
+	{
+	}
+};
+
+template< typename T, size_t Capacity = 0 >
+struct BlockNode : BlockHeader< T >, block_capacity_field< Capacity >
+{
+	using header = BlockHeader< T >;
+	using header::block_size;
+	using header::constructed;
+	using header::first_node;
+	using header::free_slots;
+	using header::last_node;
+	using header::mapped;
+	using header::references;
+	using header::slots_offset;
+	using block_capacity_field< Capacity >::block_capacity;
+
+	static BlockNode* from(header* block) noexcept { return static_cast< BlockNode* >(block); }
+	static const BlockNode* from(const header* block) noexcept { return static_cast< const BlockNode* >(block); }
+
+	template< typename Allocator >
+	static BlockNode* create(size_t block_capacity, const Allocator& allocator)
+	{
+		static_assert(sizeof(BlockNode) == sizeof(header), "the block capacity must fit in the header padding");
+		chunk_allocator< Allocator > chunks(allocator);
+		chunk* memory = chunk_traits< Allocator >::allocate(chunks, chunk_count(block_capacity));
+		return ::new (static_cast< void* >(memory)) BlockNode(block_capacity);
+	}
+
+	template< typename Allocator >
+	static void destroy(BlockNode* block, const Allocator& allocator) noexcept
+	{
+		if (block->mapped)
+		{
+			return;
+		}
+		const size_t chunks_used = chunk_count(block->block_capacity);
+		block->~BlockNode();
+		chunk_allocator< Allocator > chunks(allocator);
+		chunk_traits< Allocator >::deallocate(chunks, reinterpret_cast< chunk* >(block), chunks_used);
+	}
+
+	// Drops one owner's reference; the last owner destroys the block.
+	template< typename Allocator >
+	static void discard(BlockNode* block, const Allocator& allocator) noexcept
+	{
+		if (block->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			destroy(block, allocator);
+		}
+	}
+
+	static size_t allocation_size(size_t block_capacity) { return chunk_count(block_capacity) * sizeof(chunk); }
+
+	bool full() const noexcept { return !free_slots && constructed == block_capacity; }
+
+	void retain() noexcept { references.fetch_add(1, std::memory_order_relaxed); }
+	bool shared() const noexcept { return references.load(std::memory_order_acquire) != 1; }
+
+	Node< T >* slots() const noexcept { return reinterpret_cast< Node< T >* >(bytes() + slots_offset()); }
+
+	static constexpr size_t occupancy_words(size_t slots) { return (slots + 63) / 64; }
+
+	uint64_t* occupancy() const noexcept
+	{
+		return reinterpret_cast< uint64_t* >(bytes() + occupancy_offset(block_capacity));
+	}
+
+	bool live(size_t slot) const noexcept { return (occupancy()[slot / 64] >> (slot % 64)) & 1; }
+
+	template< typename Function >
+	void for_each_live(Function&& function)
+	{
+		const uint64_t* words = occupancy();
+		for (size_t word = 0; word < occupancy_words(constructed); ++word)
+		{
+			for (uint64_t bits = words[word]; bits != 0; bits &= bits - 1)
+			{
+				function(slots()[word * 64 + static_cast< size_t >(std::countr_zero(bits))]);
+			}
+		}
+	}
+
+	template< typename Function >
+	void for_each_live(Function&& function) const
+	{
+		const uint64_t* words = occupancy();
+		for (size_t word = 0; word < occupancy_words(constructed); ++word)
+		{
+			for (uint64_t bits = words[word]; bits != 0; bits &= bits - 1)
+			{
+				const size_t slot = word * 64 + static_cast< size_t >(std::countr_zero(bits));
+				function(static_cast< const Node< T >& >(slots()[slot]));
+			}
+		}
+	}
+
+	Node< T >* free_slot() noexcept
+	{
+		if (free_slots)
+		{
+			return free_slots;
+		}
+		Node< T >* slot = ::new (static_cast< void* >(slots() + constructed)) Node< T >();
+		slot->position = static_cast< uint32_t >(constructed);
+		return slot;
+	}
+
+	void acquire(uint64_t generation) noexcept
+	{
+		size_t slot;
+		if (free_slots)
+		{
+			slot = free_slots->position;
+			free_slots = Node< T >::from(free_slots->next);
+		}
+		else
+		{
+			slot = constructed++;
+		}
+		occupancy()[slot / 64] |= uint64_t(1) << (slot % 64);
+		slots()[slot].generation = generation;
+	}
+
+	void reset() noexcept
+	{
+		if constexpr (!std::is_trivially_destructible_v< T >)
+		{
+			for_each_live([](Node< T >& slot) { slot.destroy_data(); });
+		}
+		std::memset(occupancy(), 0, occupancy_words(constructed) * sizeof(uint64_t));
+		block_size = 0;
+		constructed = 0;
+		free_slots = nullptr;
+		first_node = nullptr;
+		last_node = nullptr;
+	}
+
+	void release(Node< T >* slot) noexcept
+	{
+		const size_t index = slot->position;
+		occupancy()[index / 64] &= ~(uint64_t(1) << (index % 64));
+		slot->destroy_data();
+		slot->prev = nullptr;
+		slot->next = free_slots;
+		free_slots = slot;
+	}
+
+  private:
+	unsigned char* bytes() const noexcept
+	{
+		return const_cast< unsigned char* >(reinterpret_cast< const unsigned char* >(this));
+	}
+
+	static constexpr size_t occupancy_offset(size_t block_capacity)
+	{
+		const size_t slots_end = slots_offset() + block_capacity * sizeof(Node< T >);
+		return (slots_end + alignof(uint64_t) - 1) / alignof(uint64_t) * alignof(uint64_t);
+	}
+
+	using chunk = aligned_chunk< std::max(cache_line_size, alignof(Node< T >)) >;
+	template< typename Allocator >
+	using chunk_allocator = typename std::allocator_traits< Allocator >::template rebind_alloc< chunk >;
+	template< typename Allocator >
+	using chunk_traits = std::allocator_traits< chunk_allocator< Allocator > >;
+
+	static size_t chunk_count(size_t block_capacity)
+	{
+		const size_t end = occupancy_offset(block_capacity) + occupancy_words(block_capacity) * sizeof(uint64_t);
+		return (end + sizeof(chunk) - 1) / sizeof(chunk);
+	}
+
+	explicit BlockNode(size_t block_capacity) : block_capacity_field< Capacity >(block_capacity)
+	{
+		std::memset(occupancy(), 0, occupancy_words(block_capacity) * sizeof(uint64_t));
+	}
+
+	~BlockNode() { reset(); }
+};
+
+#endif	  // LABA3_BLOCK_H
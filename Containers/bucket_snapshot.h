@@ -0,0 +1,161 @@
+#ifndef LABA3_BUCKET_SNAPSHOT_H
+#define LABA3_BUCKET_SNAPSHOT_H
+
+#include "block.h"
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+class BucketStorage;
+
+// Read-only point-in-time view of a BucketStorage. It holds a reference on every block it saw, and the storage copies a
+// block before changing it, or handing out mutable access to it, while the block is still referenced here. Only the
+// links inside each block are followed, because the storage keeps rewriting the links between neighbouring blocks.
+template< typename T, typename Allocator, size_t BlockCapacity = 0 >
+class BucketSnapshot
+{
+	template< typename, typename, size_t >
+	friend class BucketStorage;
+
+	using node = Node< T >;
+	using block = BlockNode< T, BlockCapacity >;
+	struct captured_block
+	{
+		block* ptr;
+		const node* first;
+		const node* last;
+	};
+	using alloc_traits = std::allocator_traits< Allocator >;
+	using block_allocator = typename alloc_traits::template rebind_alloc< captured_block >;
+	using region_allocator = typename alloc_traits::template rebind_alloc< std::shared_ptr< void > >;
+
+  public:
+	using value_type = T;
+	using reference = const T&;
+	using const_reference = const T&;
+	using pointer = const T*;
+	using const_pointer = const T*;
+	using size_type = size_t;
+	using difference_type = ptrdiff_t;
+	using allocator_type = Allocator;
+
+	class const_iterator
+	{
+	  public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const T*;
+		using reference = const T&;
+
+		const_iterator() = default;
+
+		const_iterator& operator++()
+		{
+			if (current == owner->last)
+			{
+				++owner;
+				current = owner == blocks_end ? nullptr : owner->first;
+			}
+			else
+			{
+				current = node::from(current->next);
+			}
+			return *this;
+		}
+
+		const_iterator operator++(int)
+		{
+			const_iterator tmp = *this;
+			++(*this);
+			return tmp;
+		}
+
+		bool operator==(const const_iterator& other) const { return current == other.current; }
+		bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+		const T& operator*() const { return *current->data(); }
+		const T* operator->() const { return current->data(); }
+
+	  private:
+		friend class BucketSnapshot;
+
+		const_iterator(const captured_block* owner, const captured_block* blocks_end) :
+			owner(owner), blocks_end(blocks_end), current(owner == blocks_end ? nullptr : owner->first)
+		{
+		}
+
+		const captured_block* owner = nullptr;
+		const captured_block* blocks_end = nullptr;
+		const node* current = nullptr;
+	};
+	using iterator = const_iterator;
+
+	BucketSnapshot(const BucketSnapshot&) = delete;
+	BucketSnapshot& operator=(const BucketSnapshot&) = delete;
+
+	BucketSnapshot(BucketSnapshot&& other) noexcept :
+		blocks(std::move(other.blocks)), regions(std::move(other.regions)), _size(std::exchange(other._size, 0)),
+		allocator(other.allocator)
+	{
+		other.blocks.clear();
+	}
+
+	// Rebuilt in place: the blocks go back to the allocator they came from, and a polymorphic_allocator cannot be
+	// assigned.
+	BucketSnapshot& operator=(BucketSnapshot&& other) noexcept
+	{
+		if (this != &other)
+		{
+			std::destroy_at(this);
+			std::construct_at(this, std::move(other));
+		}
+		return *this;
+	}
+
+	~BucketSnapshot()
+	{
+		for (const captured_block& captured : blocks)
+		{
+			block::discard(captured.ptr, allocator);
+		}
+	}
+
+	size_t size() const noexcept { return _size; }
+	bool empty() const noexcept { return _size == 0; }
+
+	const_iterator begin() const noexcept { return const_iterator(blocks.data(), blocks.data() + blocks.size()); }
+	const_iterator end() const noexcept
+	{
+		return const_iterator(blocks.data() + blocks.size(), blocks.data() + blocks.size());
+	}
+	const_iterator cbegin() const noexcept { return begin(); }
+	const_iterator cend() const noexcept { return end(); }
+
+	template< typename Function >
+	void for_each_block(Function&& function) const
+	{
+		for (const captured_block& captured : blocks)
+		{
+			const block* owner = captured.ptr;
+			owner->for_each_live([&function](const node& slot) { function(*slot.data()); });
+		}
+	}
+
+  private:
+	explicit BucketSnapshot(const Allocator& allocator) :
+		blocks(block_allocator(allocator)), regions(region_allocator(allocator)), _size(0), allocator(allocator)
+	{
+	}
+
+	std::vector< captured_block, block_allocator > blocks;
+	std::vector< std::shared_ptr< void >, region_allocator > regions;
+	size_t _size;
+	Allocator allocator;
+};
+
+#endif	  // LABA3_BUCKET_SNAPSHOT_H
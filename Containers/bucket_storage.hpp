@@ -1,401 +1,2598 @@
-#ifndef LABA3_BUCKET_STORAGE_HPP
-#define LABA3_BUCKET_STORAGE_HPP
-
-#include "block.h"
-#include "list_iterator.h"
-#include "list_stack.h"
-
-#include <cstdint>
-#include <cstring>
-#include <iostream>
-#include <limits>
-#include <utility>
-
-template< typename T >
-class BucketStorage
-{
-	friend class Node< T >;
-	friend class BlockNode< T >;
-
-  public:
-	using value_type = T;
-	using reference = T&;
-	using const_reference = const T&;
-	using pointer = T*;
-	using difference_type = ptrdiff_t;
-	using const_pointer = const T*;
-	using size_type = size_t;
-	using iterator = list_iterator< T >;
-	using const_iterator = list_iterator< const T >;
-
-	explicit BucketStorage(size_t block_capacity = 64);
-	BucketStorage(const BucketStorage< T >& other);
-	BucketStorage(BucketStorage< T >&& other) noexcept;
-	BucketStorage< T >& operator=(const BucketStorage< T >& other);
-	BucketStorage< T >& operator=(BucketStorage< T >&& other) noexcept;
-
-	size_t size() const noexcept;
-	bool empty() const noexcept;
-	void clear() noexcept;
-	void compact_memory() noexcept;
-	template< typename U >
-	iterator insert_impl(U&& value);
-	iterator insert(const value_type& value);
-	iterator insert(value_type&& value);
-	iterator erase(iterator it) noexcept;
-	size_t capacity() const noexcept;
-	void swap(BucketStorage& other) noexcept;
-	void shrink_to_fit() noexcept;
-	iterator get_to_distance(iterator it, const difference_type distance);
-
-	iterator begin() noexcept;
-	iterator end() noexcept;
-	const_iterator begin() const noexcept;
-	const_iterator end() const noexcept;
-	const_iterator cbegin() const noexcept;
-	const_iterator cend() const noexcept;
-
-	~BucketStorage();
-
-  private:
-	size_t _size;
-	size_t block_capacity;
-	size_t total_capacity;
-	using node = Node< T >;
-	using block = BlockNode< T >;
-	Stack_list< block > free_block;
-	node* tail_node;
-	void update_total_capacity();
-};
-
-template< typename T >
-BucketStorage< T >::BucketStorage(size_t block_capacity) :
-	block_capacity(block_capacity), _size(0), total_capacity(0), tail_node(nullptr)
-{
-	block* new_block = new block(block_capacity);
-	tail_node = &(new_block->data[0]);
-	tail_node->link(tail_node);
-}
-
-template< typename T >
-bool BucketStorage< T >::empty() const noexcept
-{
-	return _size == 0;
-}
-
-template< typename T >
-void BucketStorage< T >::clear() noexcept
-{
-	while (!free_block.empty())
-	{
-		delete free_block.top();
-		free_block.pop();
-	}
-	while (_size != 0)
-	{
-		erase(begin());
-	}
-	_size = 0;
-	total_capacity = 0;
-}
-
-template< typename T >
-void BucketStorage< T >::update_total_capacity()
-{
-	size_t used_blocks = (_size + block_capacity - 1) / block_capacity;
-	total_capacity = used_blocks * block_capacity;
-	compact_memory();
-}
-
-template< typename T >
-template< typename U >
-typename BucketStorage< T >::iterator BucketStorage< T >::insert_impl(U&& value)
-{
-	compact_memory();
-
-	if (free_block.empty())
-	{
-		block* new_block = new block(block_capacity);
-		node* new_node = &(new_block->data[0]);
-
-		try
-		{
-			new_node->set_data(std::forward< U >(value));
-			tail_node->prev->link(new_node);
-			new_node->link(tail_node);
-
-			++new_block->block_size;
-			++_size;
-			total_capacity += block_capacity;
-			update_total_capacity();
-		} catch (...)
-		{
-			delete new_block;
-			throw;
-		}
-	}
-	else
-	{
-		node* empty_node = free_block.top()->data.stack_element.pop();
-		tail_node->prev->link(empty_node);
-		empty_node->link(tail_node);
-
-		empty_node->set_data(std::forward< U >(value));
-		++_size;
-		++free_block.top()->data.block_size;
-	}
-
-	return iterator(tail_node->prev);
-}
-
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::insert(const value_type& value)
-{
-	return insert_impl(value);
-}
-
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::insert(value_type&& value)
-{
-	return insert_impl(std::move(value));
-}
-
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::erase(iterator it) noexcept
-{
-	node* current_node = const_cast< node* >(it.node);
-	if (current_node == tail_node)
-		return it;
-
-	iterator next_it = iterator(current_node->next);
-	if (current_node->prev)
-	{
-		current_node->prev->link(current_node->next);
-	}
-	current_node->next->prev = current_node->prev;
-	--current_node->block_ptr->block_size;
-	--_size;
-
-	if (current_node->block_ptr->block_size == 0)
-	{
-		total_capacity = block_capacity * 2;
-		compact_memory();
-	}
-
-	current_node->~node();
-	current_node->block_ptr = nullptr;
-
-	return next_it;
-}
-
-template< typename T >
-size_t BucketStorage< T >::size() const noexcept
-{
-	return _size;
-}
-
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::begin() noexcept
-{
-	return iterator(tail_node->next);
-}
-
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::end() noexcept
-{
-	return iterator(tail_node);
-}
-
-template< typename T >
-typename BucketStorage< T >::const_iterator BucketStorage< T >::begin() const noexcept
-{
-	return const_iterator(tail_node->next);
-}
-
-template< typename T >
-typename BucketStorage< T >::const_iterator BucketStorage< T >::end() const noexcept
-{
-	return const_iterator(tail_node);
-}
-
-template< typename T >
-typename BucketStorage< T >::const_iterator BucketStorage< T >::cbegin() const noexcept
-{
-	return const_iterator((Node< const value_type >*)tail_node->next);
-}
-
-template< typename T >
-typename BucketStorage< T >::const_iterator BucketStorage< T >::cend() const noexcept
-{
-	return const_iterator((Node< const value_type >*)tail_node);
-}
-
-template< typename T >
-size_t BucketStorage< T >::capacity() const noexcept
-{
-	return total_capacity;
-}
-
-template< typename T >
-void BucketStorage< T >::swap(BucketStorage& other) noexcept
-{
-	std::swap(_size, other._size);
-	std::swap(block_capacity, other.block_capacity);
-	std::swap(total_capacity, other.total_capacity);
-	std::swap(free_block, other.free_block);
-	std::swap(tail_node, other.tail_node);
-}
-
-template< typename T >
-void BucketStorage< T >::shrink_to_fit() noexcept
-{
-	BucketStorage< T > temporary_copy = *this;
-	swap(temporary_copy);
-}
-
-template< typename T >
-typename BucketStorage< T >::iterator BucketStorage< T >::get_to_distance(iterator it, const difference_type distance)
-{
-	if (distance < 0)
-	{
-		for (size_t i = 0; i < static_cast< size_t >(-distance); ++i, ++it)
-			;
-	}
-	else
-	{
-		for (size_t i = 0; i < static_cast< size_t >(distance); ++i, ++it)
-			;
-	}
-	return it;
-}
-
-template< typename T >
-void BucketStorage< T >::compact_memory() noexcept
-{
-	while (!free_block.empty())
-	{
-		if (free_block.top()->data.block_size == 0)
-		{
-			delete free_block.top();
-			free_block.pop();
-			total_capacity -= block_capacity;
-		}
-		else
-		{
-			break;
-		}
-	}
-}
-
-template< typename T >
-BucketStorage< T >::BucketStorage(const BucketStorage< T >& other) :
-	block_capacity(other.block_capacity), _size(0), total_capacity(0), tail_node(nullptr)
-{
-	if (other.empty())
-	{
-		return;
-	}
-
-	block* new_block = new block(other.block_capacity);
-	tail_node = &(new_block->data[0]);
-	tail_node->link(tail_node);
-
-	try
-	{
-		node* current = other.tail_node->next;
-		while (current != other.tail_node)
-		{
-			insert(*current->data);
-			current = current->next;
-		}
-	} catch (...)
-	{
-		delete new_block;
-		tail_node = nullptr;
-		throw;
-	}
-}
-
-template< typename T >
-BucketStorage< T >::BucketStorage(BucketStorage< T >&& other) noexcept :
-	_size(other._size), block_capacity(other.block_capacity), total_capacity(other.total_capacity),
-	free_block(std::move(other.free_block)), tail_node(other.tail_node)
-{
-	other._size = 0;
-	other.block_capacity = 0;
-	other.total_capacity = 0;
-	other.tail_node = nullptr;
-}
-
-template< typename T >
-BucketStorage< T >& BucketStorage< T >::operator=(const BucketStorage< T >& other)
-{
-	if (this != &other)
-	{
-		clear();
-		block_capacity = other.block_capacity;
-		_size = 0;
-		total_capacity = 0;
-		tail_node = nullptr;
-
-		if (!other.empty())
-		{
-			block* new_block = new block(other.block_capacity);
-			tail_node = &(new_block->data[0]);
-			tail_node->link(tail_node);
-
-			try
-			{
-				node* current = other.tail_node->next;
-				while (current != other.tail_node)
-				{
-					insert(*current->data);
-					current = current->next;
-				}
-			} catch (...)
-			{
-				delete new_block;
-				tail_node = nullptr;
-				throw;
-			}
-		}
-	}
-	return *this;
-}
-
-template< typename T >
-BucketStorage< T >& BucketStorage< T >::operator=(BucketStorage< T >&& other) noexcept
-{
-	if (this != &other)
-	{
-		clear();
-		block_capacity = other.block_capacity;
-		_size = other._size;
-		total_capacity = other.total_capacity;
-		free_block = std::move(other.free_block);
-		tail_node = other.tail_node;
-
-		other._size = 0;
-		other.block_capacity = 0;
-		other.total_capacity = 0;
-		other.tail_node = nullptr;
-	}
-	return *this;
-}
-
-template< typename T >
-BucketStorage< T >::~BucketStorage()
-{
-	clear();
-	if (tail_node)
-	{
-		delete[] tail_node;
-	}
-	while (!free_block.empty())
-	{
-		delete free_block.top();
-		free_block.pop();
-	}
-}
-
-#endif	  // LABA3_BUCKET_STORAGE_HPP
+#ifndef LABA3_BUCKET_STORAGE_HPP
+#define LABA3_BUCKET_STORAGE_HPP
+
+#include "block.h"
+#include "bucket_snapshot.h"
+#include "list_iterator.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifndef LABA3_BUCKET_STORAGE_STATS
+#define LABA3_BUCKET_STORAGE_STATS 1
+#endif
+
+#if LABA3_BUCKET_STORAGE_STATS
+struct bucket_storage_stats
+{
+	size_t live_elements = 0;
+	size_t allocated_blocks = 0;
+	size_t empty_blocks = 0;
+	size_t slot_capacity = 0;
+	std::array< size_t, 11 > occupancy_histogram = {};
+	size_t element_bytes = 0;
+	size_t metadata_bytes = 0;
+	size_t blocks_allocated_total = 0;
+	size_t blocks_freed_total = 0;
+};
+#endif
+
+#ifndef LABA3_BUCKET_STORAGE_MAPPING
+#if __has_include(<sys/mman.h>)
+#define LABA3_BUCKET_STORAGE_MAPPING 1
+#else
+#define LABA3_BUCKET_STORAGE_MAPPING 0
+#endif
+#endif
+
+#if LABA3_BUCKET_STORAGE_MAPPING
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct bucket_storage_file_header
+{
+	char magic[8] = {};
+	uint32_t version = 0;
+	uint32_t value_size = 0;
+	uint32_t value_alignment = 0;
+	uint32_t node_size = 0;
+	uint64_t slots_offset = 0;
+	uint64_t base = 0;
+	uint64_t length = 0;
+	uint64_t block_count = 0;
+	uint64_t size = 0;
+	uint64_t last_generation = 0;
+	uint64_t block_capacity = 0;
+	uint64_t growth_limit = 0;
+};
+
+struct bucket_storage_file_block
+{
+	uint64_t offset = 0;
+	uint64_t size = 0;
+	uint64_t capacity = 0;
+};
+#endif
+
+template< typename T, typename Allocator = std::allocator< T >, size_t BlockCapacity = 0 >
+class BucketStorage
+{
+	static_assert(BlockCapacity == 0 || std::has_single_bit(BlockCapacity), "BlockCapacity must be a power of two");
+
+	friend class Node< T >;
+	friend struct BlockNode< T, BlockCapacity >;
+
+  public:
+	using value_type = T;
+	using reference = T&;
+	using const_reference = const T&;
+	using pointer = T*;
+	using difference_type = ptrdiff_t;
+	using const_pointer = const T*;
+	using size_type = size_t;
+	using iterator = list_iterator< T >;
+	using const_iterator = list_iterator< const T >;
+	using allocator_type = Allocator;
+	using snapshot_type = BucketSnapshot< T, Allocator, BlockCapacity >;
+
+	struct handle
+	{
+		uint32_t block = 0;
+		uint32_t slot = 0;
+		uint64_t generation = 0;
+
+		bool operator==(const handle& other) const noexcept = default;
+	};
+
+  private:
+	using alloc_traits = std::allocator_traits< Allocator >;
+
+  public:
+	explicit BucketStorage(
+		size_t block_capacity = BlockCapacity == 0 ? 64 : BlockCapacity, const Allocator& allocator = Allocator());
+	explicit BucketStorage(const Allocator& allocator);
+	BucketStorage(const BucketStorage< T, Allocator, BlockCapacity >& other);
+	BucketStorage(const BucketStorage< T, Allocator, BlockCapacity >& other, const Allocator& allocator);
+	BucketStorage(BucketStorage< T, Allocator, BlockCapacity >&& other) noexcept;
+	BucketStorage< T, Allocator, BlockCapacity >& operator=(const BucketStorage< T, Allocator, BlockCapacity >& other);
+	BucketStorage< T, Allocator, BlockCapacity >& operator=(
+		BucketStorage< T, Allocator, BlockCapacity >&& other) noexcept(
+		alloc_traits::propagate_on_container_move_assignment::value ||
+		alloc_traits::is_always_equal::value);
+
+	allocator_type get_allocator() const noexcept;
+
+	size_t size() const noexcept;
+	bool empty() const noexcept;
+	void clear() noexcept;
+	void compact_memory() noexcept;
+	void reserve(size_t count);
+	void set_retained_blocks(size_t count) noexcept;
+	size_t retained_blocks() const noexcept;
+	void set_max_block_capacity(size_t capacity) noexcept;
+	size_t max_block_capacity() const noexcept;
+	template< typename... Args >
+	iterator emplace(Args&&... args);
+	iterator insert(const value_type& value);
+	iterator insert(value_type&& value);
+	template< typename InputIt, typename = typename std::iterator_traits< InputIt >::iterator_category >
+	iterator insert(InputIt first, InputIt last);
+	iterator insert_n(size_t count, const value_type& value);
+	iterator erase(const_iterator it);
+	iterator erase(const_iterator first, const_iterator last);
+	size_t capacity() const noexcept;
+	void swap(BucketStorage& other) noexcept;
+	iterator splice(BucketStorage&& other);
+	iterator merge(BucketStorage& other);
+	void shrink_to_fit() noexcept;
+	template< typename Relocated >
+	size_t defragment(size_t budget, Relocated relocated);
+	snapshot_type snapshot() const;
+	iterator get_to_distance(iterator it, const difference_type distance);
+	handle get_handle(const_iterator it) const noexcept;
+	T* get(handle h);
+	const T* get(handle h) const noexcept;
+	iterator writable(const_iterator it);
+#if LABA3_BUCKET_STORAGE_STATS
+	bucket_storage_stats stats() const noexcept;
+#endif
+#if LABA3_BUCKET_STORAGE_MAPPING
+	void save(const std::string& path) const;
+	static BucketStorage load_mapped(const std::string& path, const Allocator& allocator = Allocator());
+#endif
+	template< typename Function >
+	void for_each_block(Function&& function);
+	template< typename Function >
+	void for_each_block(Function&& function) const;
+	template< typename Function >
+	void parallel_for_each(Function&& function, size_t thread_count = 0);
+	template< typename Function >
+	void parallel_for_each(Function&& function, size_t thread_count = 0) const;
+	template< typename U, typename Reduce, typename Map >
+	U parallel_reduce(U init, Reduce reduce, Map map, size_t thread_count = 0) const;
+
+	iterator begin() noexcept;
+	iterator end() noexcept;
+	const_iterator begin() const noexcept;
+	const_iterator end() const noexcept;
+	const_iterator cbegin() const noexcept;
+	const_iterator cend() const noexcept;
+
+	~BucketStorage();
+
+	template< typename U, typename A, size_t C, typename Predicate >
+	friend size_t erase_if(BucketStorage< U, A, C >& storage, Predicate predicate);
+
+  private:
+	size_t _size;
+	size_t block_capacity;
+	size_t growth_limit;
+	size_t total_capacity;
+	using node = Node< T >;
+	using links = NodeLinks< T >;
+	using block = BlockNode< T, BlockCapacity >;
+	struct block_entry
+	{
+		block* ptr;
+		size_t size;
+	};
+	using index_allocator = typename alloc_traits::template rebind_alloc< block_entry >;
+	struct block_id_entry
+	{
+		block* ptr;
+		size_t next_free;
+	};
+	using id_allocator = typename alloc_traits::template rebind_alloc< block_id_entry >;
+	struct mapped_region
+	{
+		std::shared_ptr< void > mapping;
+		size_t length;
+	};
+	using region_allocator = typename alloc_traits::template rebind_alloc< mapped_region >;
+	using candidate_allocator = typename alloc_traits::template rebind_alloc< block* >;
+	// Progress of defragment between calls. The candidates are kept at the top of the free stack in target order, and
+	// the plan is rebuilt after any insertion or any change to the set of blocks or to the free stack.
+	struct defragment_plan
+	{
+		std::vector< block*, candidate_allocator > candidates;
+		block* previous = nullptr;
+		size_t target = 0;
+		size_t donor = 0;
+		size_t available = 0;
+		uint64_t generation = 0;
+		bool current = false;
+
+		explicit defragment_plan(const candidate_allocator& allocator) : candidates(allocator) {}
+	};
+	// Members only mapped storages and defragment use, allocated on first use so that an empty storage stays small.
+	struct rare_members
+	{
+		std::vector< mapped_region, region_allocator > mappings;
+		defragment_plan compaction;
+
+		explicit rare_members(const Allocator& allocator) :
+			mappings(region_allocator(allocator)), compaction(candidate_allocator(allocator))
+		{
+		}
+	};
+	using rare_allocator = typename alloc_traits::template rebind_alloc< rare_members >;
+	using rare_traits = std::allocator_traits< rare_allocator >;
+	static constexpr size_t no_block_id = std::numeric_limits< size_t >::max();
+	block* free_block;
+	std::vector< block_entry, index_allocator > block_index;
+	std::vector< block_id_entry, id_allocator > block_ids;
+	rare_members* rare;
+	size_t free_block_id;
+	uint64_t last_generation;
+	mutable bool shared_blocks;
+	size_t released_blocks;
+	size_t empty_blocks;
+	size_t retained_limit;
+	size_t reserved_capacity;
+	links sentinel;
+	links* tail_node;
+	allocator_type allocator;
+#if LABA3_BUCKET_STORAGE_STATS
+	size_t blocks_allocated_total = 0;
+	size_t blocks_freed_total = 0;
+#endif
+	void attach_block(block* new_block);
+	void release_block(block* old_block) noexcept;
+	void register_block(block* new_block);
+	void destroy_block(block* old_block) noexcept;
+	void compact_index() noexcept;
+	void destroy_blocks() noexcept;
+	bool mapped_block(const block* candidate) const noexcept;
+	void push_free_block(block* free) noexcept;
+	void link_nodes(block* owner, node* first, node* last, size_t count) noexcept;
+	void reserve_free_slots(size_t count);
+	template< typename Construct >
+	iterator insert_bulk(size_t count, Construct construct);
+	void unlink_node(block* owner, node* old_node) noexcept;
+	void drop_node(node* old_node, links* previous) noexcept;
+	block* unshare(block* shared);
+	void unshare_blocks();
+	static links* rebase_node(links* candidate, const block* shared, block* copy) noexcept;
+	void settle_blocks() noexcept;
+	void release_empty_blocks() noexcept;
+	void plan_defragment();
+	rare_members& rare_state();
+	void drop_rare_state() noexcept;
+	void forget_defragment_plan() noexcept;
+	template< typename Predicate >
+	size_t erase_matching(Predicate& predicate);
+	BucketStorage(const BucketStorage& other, const Allocator& allocator, uint64_t last_generation);
+	void clone_blocks(const BucketStorage& other);
+	template< typename Relocate >
+	static void copy_slots(const block* source, block* copy, Relocate relocate) noexcept(
+		std::is_trivially_copyable_v< T >);
+#if LABA3_BUCKET_STORAGE_MAPPING
+	static bucket_storage_file_header file_layout() noexcept;
+	static constexpr size_t file_alignment = std::max(cache_line_size, alignof(node));
+	static constexpr size_t file_blocks_offset(size_t block_count) noexcept;
+	void attach_mapped(unsigned char* address, const bucket_storage_file_header& header) noexcept;
+	static constexpr size_t no_slot = std::numeric_limits< size_t >::max();
+	static bool valid_mapped_block(
+		const block* loaded, const bucket_storage_file_header& header, const bucket_storage_file_block& entry,
+		const links* before, const links* after) noexcept;
+#endif
+	template< typename Body >
+	void run_partitioned(size_t thread_count, Body&& body) const;
+	size_t next_block_capacity(size_t missing) const noexcept;
+	void init_tail() noexcept;
+	void adopt_chain(links* other_tail) noexcept;
+	void swap_members(BucketStorage& other) noexcept;
+};
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+BucketStorage< T, Allocator, BlockCapacity >::BucketStorage(size_t block_capacity, const Allocator& allocator) :
+	_size(0), block_capacity(std::clamp< size_t >(block_capacity, 1, std::numeric_limits< uint32_t >::max())),
+	growth_limit(this->block_capacity), total_capacity(0), free_block(nullptr), block_index(index_allocator(allocator)),
+	block_ids(id_allocator(allocator)), rare(nullptr), free_block_id(no_block_id), last_generation(0),
+	shared_blocks(false), released_blocks(0), empty_blocks(0), retained_limit(0), reserved_capacity(0),
+	tail_node(nullptr), allocator(allocator)
+{
+	if (BlockCapacity != 0 && block_capacity != BlockCapacity)
+	{
+		throw std::invalid_argument("BucketStorage: block capacity differs from the fixed BlockCapacity");
+	}
+	init_tail();
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+BucketStorage< T, Allocator, BlockCapacity >::BucketStorage(const Allocator& allocator) :
+	BucketStorage(BlockCapacity == 0 ? 64 : BlockCapacity, allocator)
+{
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::allocator_type
+	BucketStorage< T, Allocator, BlockCapacity >::get_allocator() const noexcept
+{
+	return allocator;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+size_t BucketStorage< T, Allocator, BlockCapacity >::next_block_capacity(size_t missing) const noexcept
+{
+	if constexpr (BlockCapacity != 0)
+	{
+		return BlockCapacity;
+	}
+	else
+	{
+		return std::clamp(std::max(total_capacity, missing), block_capacity, growth_limit);
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::init_tail() noexcept
+{
+	sentinel.position = links::end_position;
+	tail_node = &sentinel;
+	tail_node->link(tail_node);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::adopt_chain(links* other_tail) noexcept
+{
+	if (other_tail->next == other_tail)
+	{
+		tail_node->link(tail_node);
+		return;
+	}
+	other_tail->prev->link(tail_node);
+	tail_node->link(other_tail->next);
+	other_tail->link(other_tail);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+bool BucketStorage< T, Allocator, BlockCapacity >::empty() const noexcept
+{
+	return _size == 0;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::clear() noexcept
+{
+	free_block = nullptr;
+	forget_defragment_plan();
+	size_t kept = 0;
+	size_t kept_capacity = 0;
+	for (const block_entry& entry : block_index)
+	{
+		if (!entry.ptr)
+		{
+			continue;
+		}
+		if (!entry.ptr->shared() && (kept < retained_limit || kept_capacity < reserved_capacity))
+		{
+			entry.ptr->reset();
+			entry.ptr->index = kept;
+			block_index[kept++] = block_entry{ entry.ptr, 0 };
+			kept_capacity += entry.ptr->block_capacity;
+		}
+		else
+		{
+			destroy_block(entry.ptr);
+		}
+	}
+	block_index.resize(kept, block_entry{ nullptr, 0 });
+	for (size_t i = kept; i-- > 0;)
+	{
+		push_free_block(block_index[i].ptr);
+	}
+	released_blocks = 0;
+	empty_blocks = kept;
+	total_capacity = kept_capacity;
+	tail_node->link(tail_node);
+	_size = 0;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+bool BucketStorage< T, Allocator, BlockCapacity >::mapped_block(const block* candidate) const noexcept
+{
+	// Checked against the regions rather than block->mapped so that tearing down a mapped storage does not fault its
+	// pages in.
+	if (!rare)
+	{
+		return false;
+	}
+	const uintptr_t address = reinterpret_cast< uintptr_t >(candidate);
+	for (const mapped_region& region : rare->mappings)
+	{
+		const uintptr_t first = reinterpret_cast< uintptr_t >(region.mapping.get());
+		if (address >= first && address - first < region.length)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::destroy_blocks() noexcept
+{
+	free_block = nullptr;
+	forget_defragment_plan();
+	for (const block_entry& entry : block_index)
+	{
+		if (entry.ptr)
+		{
+#if LABA3_BUCKET_STORAGE_STATS
+			++blocks_freed_total;
+#endif
+			if (!mapped_block(entry.ptr))
+			{
+				block::discard(entry.ptr, allocator);
+			}
+		}
+	}
+	block_index.clear();
+	block_ids.clear();
+	if (rare)
+	{
+		rare->mappings.clear();
+	}
+	free_block_id = no_block_id;
+	released_blocks = 0;
+	empty_blocks = 0;
+	total_capacity = 0;
+	_size = 0;
+	tail_node->link(tail_node);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::reserve(size_t count)
+{
+	if (count > _size)
+	{
+		reserve_free_slots(count - _size);
+	}
+	if (count > reserved_capacity)
+	{
+		reserved_capacity = count;
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::set_retained_blocks(size_t count) noexcept
+{
+	retained_limit = count;
+	compact_memory();
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+size_t BucketStorage< T, Allocator, BlockCapacity >::retained_blocks() const noexcept
+{
+	return retained_limit;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::set_max_block_capacity(size_t capacity) noexcept
+{
+	if constexpr (BlockCapacity == 0)
+	{
+		growth_limit = std::clamp(capacity, block_capacity, size_t(std::numeric_limits< uint32_t >::max()));
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+size_t BucketStorage< T, Allocator, BlockCapacity >::max_block_capacity() const noexcept
+{
+	return growth_limit;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::attach_block(block* new_block)
+{
+	register_block(new_block);
+	new_block->index = block_index.size();
+	try
+	{
+		block_index.push_back(block_entry{ new_block, 0 });
+	} catch (...)
+	{
+		block_ids[new_block->id] = block_id_entry{ nullptr, free_block_id };
+		free_block_id = new_block->id;
+#if LABA3_BUCKET_STORAGE_STATS
+		--blocks_allocated_total;
+#endif
+		throw;
+	}
+	total_capacity += new_block->block_capacity;
+	++empty_blocks;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::release_block(block* old_block) noexcept
+{
+	block_index[old_block->index] = block_entry{ nullptr, 0 };
+	++released_blocks;
+	--empty_blocks;
+	total_capacity -= old_block->block_capacity;
+	destroy_block(old_block);
+	if (released_blocks * 2 > block_index.size())
+	{
+		compact_index();
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::register_block(block* new_block)
+{
+#if LABA3_BUCKET_STORAGE_STATS
+	++blocks_allocated_total;
+#endif
+	if (free_block_id == no_block_id)
+	{
+		new_block->id = block_ids.size();
+		block_ids.push_back(block_id_entry{ new_block, no_block_id });
+	}
+	else
+	{
+		new_block->id = free_block_id;
+		free_block_id = block_ids[free_block_id].next_free;
+		block_ids[new_block->id].ptr = new_block;
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::destroy_block(block* old_block) noexcept
+{
+	block_ids[old_block->id] = block_id_entry{ nullptr, free_block_id };
+	free_block_id = old_block->id;
+	forget_defragment_plan();
+#if LABA3_BUCKET_STORAGE_STATS
+	++blocks_freed_total;
+#endif
+	block::discard(old_block, allocator);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::compact_index() noexcept
+{
+	size_t live = 0;
+	for (const block_entry& entry : block_index)
+	{
+		if (entry.ptr)
+		{
+			entry.ptr->index = live;
+			block_index[live++] = entry;
+		}
+	}
+	block_index.resize(live, block_entry{ nullptr, 0 });
+	released_blocks = 0;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::push_free_block(block* free) noexcept
+{
+	free->next_free = free_block;
+	free_block = free;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void
+	BucketStorage< T, Allocator, BlockCapacity >::link_nodes(
+		block* owner, node* first, node* last, size_t count) noexcept
+{
+	links* anchor = owner->last_node;
+	for (size_t i = owner->index; !anchor && i-- > 0;)
+	{
+		if (block_index[i].size != 0)
+		{
+			anchor = block_index[i].ptr->last_node;
+		}
+	}
+	if (!anchor)
+	{
+		anchor = tail_node;
+	}
+	last->link(anchor->next);
+	anchor->link(first);
+	if (!owner->first_node)
+	{
+		owner->first_node = first;
+	}
+	owner->last_node = last;
+
+	if (owner->block_size == 0)
+	{
+		--empty_blocks;
+	}
+	owner->block_size += count;
+	block_index[owner->index].size += count;
+	_size += count;
+	if (owner->full())
+	{
+		free_block = block::from(owner->next_free);
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::unlink_node(block* owner, node* old_node) noexcept
+{
+	if (old_node == owner->first_node && old_node == owner->last_node)
+	{
+		owner->first_node = nullptr;
+		owner->last_node = nullptr;
+	}
+	else if (old_node == owner->first_node)
+	{
+		owner->first_node = node::from(old_node->next);
+	}
+	else if (old_node == owner->last_node)
+	{
+		owner->last_node = node::from(old_node->prev);
+	}
+	old_node->prev->link(old_node->next);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename... Args >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::emplace(Args&&... args)
+{
+	compact_memory();
+	reserve_free_slots(1);
+
+	block* current_block = unshare(free_block);
+	node* empty_node = current_block->free_slot();
+	try
+	{
+		empty_node->set_data(std::forward< Args >(args)...);
+	} catch (...)
+	{
+		compact_memory();
+		throw;
+	}
+	current_block->acquire(++last_generation);
+	link_nodes(current_block, empty_node, empty_node, 1);
+
+	return iterator(empty_node);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::insert(const value_type& value)
+{
+	return emplace(value);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::insert(value_type&& value)
+{
+	return emplace(std::move(value));
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename InputIt, typename >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::insert(InputIt first, InputIt last)
+{
+	using category = typename std::iterator_traits< InputIt >::iterator_category;
+	if constexpr (std::is_base_of_v< std::forward_iterator_tag, category >)
+	{
+		const size_t count = static_cast< size_t >(std::distance(first, last));
+		return insert_bulk(count, [&first](node* slot) {
+			slot->set_data(*first);
+			++first;
+		});
+	}
+	else
+	{
+		iterator inserted = end();
+		for (; first != last; ++first)
+		{
+			iterator current = emplace(*first);
+			if (inserted == end())
+			{
+				inserted = current;
+			}
+		}
+		return inserted;
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::insert_n(size_t count, const value_type& value)
+{
+	return insert_bulk(count, [&value](node* slot) { slot->set_data(value); });
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::reserve_free_slots(size_t count)
+{
+	const size_t first_new = block_index.size();
+	size_t free_slots = total_capacity - _size;
+	try
+	{
+		while (free_slots < count)
+		{
+			block* new_block = block::create(next_block_capacity(count - free_slots), allocator);
+			try
+			{
+				attach_block(new_block);
+			} catch (...)
+			{
+				block::destroy(new_block, allocator);
+				throw;
+			}
+			free_slots += new_block->block_capacity;
+		}
+	} catch (...)
+	{
+		for (size_t i = block_index.size(); i-- > first_new;)
+		{
+			push_free_block(block_index[i].ptr);
+		}
+		compact_memory();
+		throw;
+	}
+	for (size_t i = block_index.size(); i-- > first_new;)
+	{
+		push_free_block(block_index[i].ptr);
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename Construct >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::insert_bulk(size_t count, Construct construct)
+{
+	if (count == 0)
+	{
+		return end();
+	}
+	compact_memory();
+	reserve_free_slots(count);
+
+	node* first_inserted = nullptr;
+	while (count != 0)
+	{
+		block* current_block = free_block;
+		node* first = nullptr;
+		node* last = nullptr;
+		size_t filled = 0;
+		try
+		{
+			current_block = unshare(current_block);
+			for (; count != 0 && !current_block->full(); --count, ++filled)
+			{
+				node* slot = current_block->free_slot();
+				construct(slot);
+				current_block->acquire(++last_generation);
+				if (last)
+				{
+					last->link(slot);
+				}
+				else
+				{
+					first = slot;
+				}
+				last = slot;
+			}
+		} catch (...)
+		{
+			if (filled != 0)
+			{
+				link_nodes(current_block, first, last, filled);
+			}
+			compact_memory();
+			throw;
+		}
+		link_nodes(current_block, first, last, filled);
+		if (!first_inserted)
+		{
+			first_inserted = first;
+		}
+	}
+	return iterator(first_inserted);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::erase(const_iterator it)
+{
+	links* current = (links*)it.node;
+	if (current == tail_node)
+		return end();
+
+	block* owner = block::from(node::from(current)->block_ptr());
+	block* current_block = unshare(owner);
+	node* current_node = node::from(rebase_node(current, owner, current_block));
+	iterator next_it = iterator(current_node->next);
+	unlink_node(current_block, current_node);
+
+	const bool was_full = current_block->full();
+	current_block->release(current_node);
+	--current_block->block_size;
+	--block_index[current_block->index].size;
+	--_size;
+
+	if (was_full)
+	{
+		push_free_block(current_block);
+	}
+	if (current_block->block_size == 0)
+	{
+		++empty_blocks;
+		compact_memory();
+	}
+
+	return next_it;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::erase(const_iterator first, const_iterator last)
+{
+	links* current = (links*)first.node;
+	links* stop = (links*)last.node;
+	if (current == stop)
+	{
+		return iterator(stop);
+	}
+
+	links* previous = current->prev;
+	try
+	{
+		while (current != stop)
+		{
+			block* owner = block::from(node::from(current)->block_ptr());
+			if (owner->shared())
+			{
+				if (previous->next != current)
+				{
+					previous->link(current);
+				}
+				block* copy = unshare(owner);
+				current = rebase_node(current, owner, copy);
+				previous = rebase_node(previous, owner, copy);
+				stop = rebase_node(stop, owner, copy);
+			}
+			links* next = current->next;
+			drop_node(node::from(current), previous);
+			current = next;
+		}
+	} catch (...)
+	{
+		previous->link(current);
+		settle_blocks();
+		throw;
+	}
+	previous->link(stop);
+	settle_blocks();
+	return iterator(stop);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename Predicate >
+size_t BucketStorage< T, Allocator, BlockCapacity >::erase_matching(Predicate& predicate)
+{
+	const size_t old_size = _size;
+	links* previous = tail_node;
+	links* current = tail_node->next;
+	try
+	{
+		while (current != tail_node)
+		{
+			if (predicate(std::as_const(*node::from(current)->data())))
+			{
+				block* owner = block::from(node::from(current)->block_ptr());
+				if (owner->shared())
+				{
+					if (previous->next != current)
+					{
+						previous->link(current);
+					}
+					block* copy = unshare(owner);
+					current = rebase_node(current, owner, copy);
+					previous = rebase_node(previous, owner, copy);
+				}
+				links* next = current->next;
+				drop_node(node::from(current), previous);
+				current = next;
+			}
+			else
+			{
+				if (previous->next != current)
+				{
+					previous->link(current);
+				}
+				previous = current;
+				current = current->next;
+			}
+		}
+	} catch (...)
+	{
+		previous->link(current);
+		settle_blocks();
+		throw;
+	}
+	previous->link(tail_node);
+	settle_blocks();
+	return old_size - _size;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::drop_node(node* old_node, links* previous) noexcept
+{
+	block* owner = block::from(old_node->block_ptr());
+	if (old_node == owner->first_node && old_node == owner->last_node)
+	{
+		owner->first_node = nullptr;
+		owner->last_node = nullptr;
+	}
+	else if (old_node == owner->first_node)
+	{
+		owner->first_node = node::from(old_node->next);
+	}
+	else if (old_node == owner->last_node)
+	{
+		owner->last_node = node::from(previous);
+	}
+	owner->release(old_node);
+	--owner->block_size;
+	--block_index[owner->index].size;
+	--_size;
+	if (owner->block_size == 0)
+	{
+		++empty_blocks;
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::block*
+	BucketStorage< T, Allocator, BlockCapacity >::unshare(block* shared)
+{
+	if constexpr (!std::is_copy_constructible_v< T >)
+	{
+		return shared;
+	}
+	else
+	{
+		if (!shared->shared())
+		{
+			return shared;
+		}
+		block* copy = block::create(shared->block_capacity, allocator);
+		forget_defragment_plan();
+		try
+		{
+			copy_slots(shared, copy, [copy, shared](const links* pointer) -> node* {
+				return pointer ? copy->slots() + (node::from(pointer) - shared->slots()) : nullptr;
+			});
+		} catch (...)
+		{
+			block::destroy(copy, allocator);
+			throw;
+		}
+		copy->index = shared->index;
+		copy->id = shared->id;
+		shared->first_node->prev->link(copy->first_node);
+		copy->last_node->link(shared->last_node->next);
+		block_index[copy->index].ptr = copy;
+		block_ids[copy->id].ptr = copy;
+		if (free_block == shared)
+		{
+			copy->next_free = shared->next_free;
+			free_block = copy;
+		}
+		for (block* free = free_block; free && free != copy; free = block::from(free->next_free))
+		{
+			if (free->next_free == shared)
+			{
+				copy->next_free = shared->next_free;
+				free->next_free = copy;
+				break;
+			}
+		}
+#if LABA3_BUCKET_STORAGE_STATS
+		++blocks_allocated_total;
+		++blocks_freed_total;
+#endif
+		block::discard(shared, allocator);
+		return copy;
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::links*
+	BucketStorage< T, Allocator, BlockCapacity >::rebase_node(
+		links* candidate, const block* shared, block* copy) noexcept
+{
+	// The shared block may already be gone, so the candidate is located by address instead of being dereferenced.
+	const uintptr_t offset = reinterpret_cast< uintptr_t >(candidate) - reinterpret_cast< uintptr_t >(shared);
+	if (offset >= block::allocation_size(copy->block_capacity))
+	{
+		return candidate;
+	}
+	return copy->slots() + (offset - block::slots_offset()) / sizeof(node);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::unshare_blocks()
+{
+	if (!shared_blocks)
+	{
+		return;
+	}
+	for (size_t i = 0; i < block_index.size(); ++i)
+	{
+		if (block_index[i].ptr && block_index[i].ptr->shared())
+		{
+			unshare(block_index[i].ptr);
+		}
+	}
+	shared_blocks = false;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::writable(const_iterator it)
+{
+	links* current = (links*)it.node;
+	if (current == tail_node)
+	{
+		return iterator(current);
+	}
+	block* owner = block::from(node::from(current)->block_ptr());
+	return iterator(rebase_node(current, owner, unshare(owner)));
+}
+
+// A block still shared with a snapshot is copied when it is first written: by insert and erase, get(handle),
+// writable(it), and the mutable for_each_block and parallel_for_each. Plain iterators write in place, so while a
+// snapshot is alive elements are written through writable(it) or get(handle). Iterators into a block that gets copied
+// are invalidated, handles are not.
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::snapshot_type
+	BucketStorage< T, Allocator, BlockCapacity >::snapshot() const
+{
+	static_assert(std::is_copy_constructible_v< T >, "snapshot requires a copy constructible value_type");
+	snapshot_type view(allocator);
+	shared_blocks = true;
+	if (rare)
+	{
+		view.regions.reserve(rare->mappings.size());
+		for (const mapped_region& region : rare->mappings)
+		{
+			view.regions.push_back(region.mapping);
+		}
+	}
+	view.blocks.reserve(block_index.size() - released_blocks);
+	for (const block_entry& entry : block_index)
+	{
+		if (entry.size != 0)
+		{
+			entry.ptr->retain();
+			view.blocks.push_back(
+				typename snapshot_type::captured_block{ entry.ptr, entry.ptr->first_node, entry.ptr->last_node });
+		}
+	}
+	view._size = _size;
+	return view;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::settle_blocks() noexcept
+{
+	for (block_entry& entry : block_index)
+	{
+		if (entry.ptr && entry.size == 0 && empty_blocks > retained_limit &&
+			total_capacity - entry.ptr->block_capacity >= reserved_capacity)
+		{
+			--empty_blocks;
+			total_capacity -= entry.ptr->block_capacity;
+			destroy_block(entry.ptr);
+			entry = block_entry{ nullptr, 0 };
+			++released_blocks;
+		}
+	}
+	if (released_blocks * 2 > block_index.size())
+	{
+		compact_index();
+	}
+	free_block = nullptr;
+	forget_defragment_plan();
+	for (size_t i = block_index.size(); i-- > 0;)
+	{
+		if (block_index[i].ptr && !block_index[i].ptr->full())
+		{
+			push_free_block(block_index[i].ptr);
+		}
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+size_t BucketStorage< T, Allocator, BlockCapacity >::size() const noexcept
+{
+	return _size;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::begin() noexcept
+{
+	return iterator(tail_node->next);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::end() noexcept
+{
+	return iterator(tail_node);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::const_iterator
+	BucketStorage< T, Allocator, BlockCapacity >::begin() const noexcept
+{
+	return const_iterator((NodeLinks< const value_type >*)tail_node->next);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::const_iterator
+	BucketStorage< T, Allocator, BlockCapacity >::end() const noexcept
+{
+	return const_iterator((NodeLinks< const value_type >*)tail_node);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::const_iterator
+	BucketStorage< T, Allocator, BlockCapacity >::cbegin() const noexcept
+{
+	return const_iterator((NodeLinks< const value_type >*)tail_node->next);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::const_iterator
+	BucketStorage< T, Allocator, BlockCapacity >::cend() const noexcept
+{
+	return const_iterator((NodeLinks< const value_type >*)tail_node);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+size_t BucketStorage< T, Allocator, BlockCapacity >::capacity() const noexcept
+{
+	return total_capacity;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::swap(BucketStorage& other) noexcept
+{
+	if constexpr (alloc_traits::propagate_on_container_swap::value)
+	{
+		using std::swap;
+		swap(allocator, other.allocator);
+	}
+	swap_members(other);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::splice(BucketStorage&& other)
+{
+	if (this == &other || other.block_index.empty())
+	{
+		return end();
+	}
+	if constexpr (!alloc_traits::is_always_equal::value)
+	{
+		if (allocator != other.allocator)
+		{
+			iterator first = insert(std::make_move_iterator(other.begin()), std::make_move_iterator(other.end()));
+			other.clear();
+			return first;
+		}
+	}
+
+	forget_defragment_plan();
+	other.forget_defragment_plan();
+	const size_t incoming = other.block_index.size() - other.released_blocks;
+	if (block_index.size() + incoming > block_index.capacity())
+	{
+		block_index.reserve(std::max(block_index.size() + incoming, block_index.capacity() * 2));
+	}
+	if (block_ids.size() + incoming > block_ids.capacity())
+	{
+		block_ids.reserve(std::max(block_ids.size() + incoming, block_ids.capacity() * 2));
+	}
+	if (other.rare && !other.rare->mappings.empty())
+	{
+		std::vector< mapped_region, region_allocator >& mappings = rare_state().mappings;
+		mappings.insert(mappings.end(), other.rare->mappings.begin(), other.rare->mappings.end());
+	}
+
+	// The incoming slots are restamped so that their generations cannot repeat one this storage has already handed out.
+	for (const block_entry& entry : other.block_index)
+	{
+		if (entry.ptr)
+		{
+			entry.ptr->index = static_cast< uint32_t >(block_index.size());
+			entry.ptr->id = static_cast< uint32_t >(block_ids.size());
+			entry.ptr->for_each_live([this](node& slot) { slot.generation = ++last_generation; });
+			block_index.push_back(entry);
+			block_ids.push_back(block_id_entry{ entry.ptr, no_block_id });
+		}
+	}
+	for (block* free = other.free_block; free;)
+	{
+		block* next = block::from(free->next_free);
+		push_free_block(free);
+		free = next;
+	}
+
+	links* first = other.tail_node->next;
+	if (first != other.tail_node)
+	{
+		tail_node->prev->link(first);
+		other.tail_node->prev->link(tail_node);
+	}
+	_size += other._size;
+	total_capacity += other.total_capacity;
+	empty_blocks += other.empty_blocks;
+	shared_blocks = shared_blocks || std::exchange(other.shared_blocks, false);
+#if LABA3_BUCKET_STORAGE_STATS
+	blocks_allocated_total += incoming;
+	other.blocks_freed_total += incoming;
+#endif
+
+	other.tail_node->link(other.tail_node);
+	other.block_index.clear();
+	other.block_ids.clear();
+	if (other.rare)
+	{
+		other.rare->mappings.clear();
+	}
+	other.free_block_id = no_block_id;
+	other.free_block = nullptr;
+	other._size = 0;
+	other.total_capacity = 0;
+	other.empty_blocks = 0;
+	other.released_blocks = 0;
+	compact_memory();
+	return iterator(first == other.tail_node ? tail_node : first);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::merge(BucketStorage& other)
+{
+	return splice(std::move(other));
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::swap_members(BucketStorage& other) noexcept
+{
+	std::swap(_size, other._size);
+	std::swap(block_capacity, other.block_capacity);
+	std::swap(growth_limit, other.growth_limit);
+	std::swap(total_capacity, other.total_capacity);
+	std::swap(empty_blocks, other.empty_blocks);
+	std::swap(retained_limit, other.retained_limit);
+	std::swap(reserved_capacity, other.reserved_capacity);
+	std::swap(free_block, other.free_block);
+	std::swap(block_index, other.block_index);
+	std::swap(block_ids, other.block_ids);
+	std::swap(rare, other.rare);
+	std::swap(free_block_id, other.free_block_id);
+	std::swap(last_generation, other.last_generation);
+	std::swap(shared_blocks, other.shared_blocks);
+	std::swap(released_blocks, other.released_blocks);
+	forget_defragment_plan();
+	other.forget_defragment_plan();
+	links* first = tail_node->next;
+	links* last = tail_node->prev;
+	adopt_chain(other.tail_node);
+	if (first != tail_node)
+	{
+		last->link(other.tail_node);
+		other.tail_node->link(first);
+	}
+#if LABA3_BUCKET_STORAGE_STATS
+	std::swap(blocks_allocated_total, other.blocks_allocated_total);
+	std::swap(blocks_freed_total, other.blocks_freed_total);
+#endif
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::shrink_to_fit() noexcept
+{
+	// Repacking moves elements between blocks. A move that may throw could not be undone here, and while a snapshot is
+	// alive repacking would copy every shared block, so in both cases only the empty blocks are given back.
+	if constexpr (!std::is_nothrow_move_constructible_v< T >)
+	{
+		release_empty_blocks();
+		return;
+	}
+	auto shared = [](const block_entry& entry) { return entry.ptr && entry.ptr->shared(); };
+	if (std::any_of(block_index.begin(), block_index.end(), shared))
+	{
+		release_empty_blocks();
+		return;
+	}
+	compact_index();
+	std::sort(block_index.begin(), block_index.end(), [](const block_entry& lhs, const block_entry& rhs) {
+		return lhs.size != rhs.size ? lhs.size > rhs.size : lhs.ptr->block_capacity > rhs.ptr->block_capacity;
+	});
+	size_t kept = 0;
+	size_t kept_capacity = 0;
+	while (kept_capacity < _size)
+	{
+		kept_capacity += block_index[kept++].ptr->block_capacity;
+	}
+
+	size_t target = 0;
+	for (size_t i = kept; i < block_index.size() && block_index[i].size != 0; ++i)
+	{
+		block* donor = block_index[i].ptr;
+		for (node* current = donor->first_node; current;
+			 current = current == donor->last_node ? nullptr : node::from(current->next))
+		{
+			while (block_index[target].ptr->full())
+			{
+				++target;
+			}
+			block* owner = block_index[target].ptr;
+			node* slot = owner->free_slot();
+			slot->set_data(std::move(*current->data()));
+			owner->acquire(++last_generation);
+			if (owner->last_node)
+			{
+				owner->last_node->link(slot);
+			}
+			else
+			{
+				owner->first_node = slot;
+			}
+			owner->last_node = slot;
+			++owner->block_size;
+			++block_index[target].size;
+		}
+	}
+
+	for (size_t i = kept; i < block_index.size(); ++i)
+	{
+		destroy_block(block_index[i].ptr);
+	}
+	block_index.resize(kept, block_entry{ nullptr, 0 });
+
+	free_block = nullptr;
+	forget_defragment_plan();
+	links* previous = tail_node;
+	for (size_t i = kept; i-- > 0;)
+	{
+		block* owner = block_index[i].ptr;
+		owner->index = i;
+		if (!owner->full())
+		{
+			push_free_block(owner);
+		}
+	}
+	for (const block_entry& entry : block_index)
+	{
+		previous->link(entry.ptr->first_node);
+		previous = entry.ptr->last_node;
+	}
+	previous->link(tail_node);
+
+	total_capacity = kept_capacity;
+	released_blocks = 0;
+	empty_blocks = 0;
+	reserved_capacity = 0;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::release_empty_blocks() noexcept
+{
+	const size_t retained = std::exchange(retained_limit, 0);
+	reserved_capacity = 0;
+	settle_blocks();
+	retained_limit = retained;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::rare_members&
+	BucketStorage< T, Allocator, BlockCapacity >::rare_state()
+{
+	if (!rare)
+	{
+		rare_allocator members(allocator);
+		rare_members* created = rare_traits::allocate(members, 1);
+		try
+		{
+			rare_traits::construct(members, created, allocator);
+		} catch (...)
+		{
+			rare_traits::deallocate(members, created, 1);
+			throw;
+		}
+		rare = created;
+	}
+	return *rare;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::drop_rare_state() noexcept
+{
+	if (rare)
+	{
+		rare_allocator members(allocator);
+		rare_traits::destroy(members, rare);
+		rare_traits::deallocate(members, rare, 1);
+		rare = nullptr;
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::forget_defragment_plan() noexcept
+{
+	if (rare)
+	{
+		rare->compaction.current = false;
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::plan_defragment()
+{
+	defragment_plan& plan = rare_state().compaction;
+	plan.current = false;
+	plan.candidates.clear();
+	plan.available = 0;
+	for (const block_entry& entry : block_index)
+	{
+		if (entry.ptr && entry.size != 0 && entry.size != entry.ptr->block_capacity && !entry.ptr->shared())
+		{
+			plan.candidates.push_back(entry.ptr);
+			plan.available += entry.ptr->block_capacity - entry.size;
+		}
+	}
+	std::sort(
+		plan.candidates.begin(),
+		plan.candidates.end(),
+		[](const block* lhs, const block* rhs) { return lhs->block_size > rhs->block_size; });
+
+	free_block = nullptr;
+	for (size_t i = block_index.size(); i-- > 0;)
+	{
+		block* other = block_index[i].ptr;
+		if (other && !other->full() && (other->block_size == 0 || other->shared()))
+		{
+			push_free_block(other);
+		}
+	}
+	for (size_t i = plan.candidates.size(); i-- > 0;)
+	{
+		push_free_block(plan.candidates[i]);
+	}
+	plan.previous = nullptr;
+	plan.target = 0;
+	plan.donor = plan.candidates.size();
+	plan.generation = last_generation;
+	plan.current = true;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename Relocated >
+size_t BucketStorage< T, Allocator, BlockCapacity >::defragment(size_t budget, Relocated relocated)
+{
+	if (!rare || !rare->compaction.current || rare->compaction.generation != last_generation)
+	{
+		plan_defragment();
+	}
+	defragment_plan& plan = rare->compaction;
+	block** partial = plan.candidates.data();
+	// Blocks pushed by erase since the last call sit above the current target.
+	if (plan.donor > plan.target + 1 &&
+		!(plan.previous ? plan.previous->next_free == partial[plan.target] : free_block == partial[plan.target]))
+	{
+		plan.previous = nullptr;
+		for (block* free = free_block; free != partial[plan.target]; free = block::from(free->next_free))
+		{
+			plan.previous = free;
+		}
+	}
+
+	// Erasing only adds free slots, so the running estimate stays a lower bound and only has to be kept from wrapping.
+	auto consume = [&plan](size_t slots) { plan.available -= std::min(plan.available, slots); };
+	auto unlink = [this, &plan, partial](size_t position) {
+		block* above = position > plan.target ? partial[position - 1] : plan.previous;
+		if (above)
+		{
+			above->next_free = partial[position]->next_free;
+		}
+		else
+		{
+			free_block = block::from(partial[position]->next_free);
+		}
+	};
+	auto retire_donor = [&] {
+		const size_t position = --plan.donor;
+		block* source = partial[position];
+		consume(source->block_capacity - source->block_size);
+		if (source->block_size == 0 && empty_blocks > retained_limit &&
+			total_capacity - source->block_capacity >= reserved_capacity)
+		{
+			unlink(position);
+			release_block(source);
+		}
+	};
+
+	size_t moved = 0;
+	try
+	{
+		while (moved < budget && plan.donor > plan.target + 1)
+		{
+			block* source = partial[plan.donor - 1];
+			block* owner = partial[plan.target];
+			if (source->shared() || owner->shared())
+			{
+				// A live snapshot still reads these blocks; the plan resumes here once it is gone.
+				break;
+			}
+			if (source->block_size == 0)
+			{
+				retire_donor();
+				continue;
+			}
+			if (owner->block_size == 0)
+			{
+				consume(owner->block_capacity - owner->block_size);
+				plan.previous = owner;
+				++plan.target;
+				continue;
+			}
+			const size_t source_free = source->block_capacity - source->block_size;
+			if (plan.available - std::min(plan.available, source_free) < source->block_size)
+			{
+				plan.donor = plan.target;
+				break;
+			}
+
+			node* current = source->first_node;
+			node* slot = owner->free_slot();
+			slot->set_data(std::move(*current->data()));
+			owner->acquire(++last_generation);
+			links* after = owner->last_node->next;
+			owner->last_node->link(slot);
+			slot->link(after);
+			owner->last_node = slot;
+			++owner->block_size;
+			++block_index[owner->index].size;
+			++_size;
+			consume(1);
+
+			links* previous = current->prev;
+			links* next = current->next;
+			try
+			{
+				relocated(const_iterator((NodeLinks< const value_type >*)current), iterator(slot));
+			} catch (...)
+			{
+				drop_node(current, previous);
+				previous->link(next);
+				throw;
+			}
+			drop_node(current, previous);
+			previous->link(next);
+			++plan.available;
+			++moved;
+			if (owner->full())
+			{
+				unlink(plan.target);
+				++plan.target;
+			}
+			if (source->block_size == 0)
+			{
+				retire_donor();
+			}
+		}
+	} catch (...)
+	{
+		settle_blocks();
+		throw;
+	}
+	plan.generation = last_generation;
+	plan.current = true;
+	return moved;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::iterator
+	BucketStorage< T, Allocator, BlockCapacity >::get_to_distance(iterator it, const difference_type distance)
+{
+	links* current = it.node;
+	size_t steps = static_cast< size_t >(distance < 0 ? -distance : distance);
+	if (steps == 0 || empty())
+	{
+		return it;
+	}
+
+	if (distance > 0)
+	{
+		if (current == tail_node)
+		{
+			current = tail_node->next;
+			--steps;
+		}
+		while (steps != 0 && current != node::from(current)->block_ptr()->last_node)
+		{
+			current = current->next;
+			--steps;
+		}
+		if (steps == 0)
+		{
+			return iterator(current);
+		}
+
+		size_t target = node::from(current)->block_ptr()->index + 1;
+		while (target < block_index.size() && steps > block_index[target].size)
+		{
+			steps -= block_index[target].size;
+			++target;
+		}
+		if (target == block_index.size())
+		{
+			return end();
+		}
+		current = block_index[target].ptr->first_node;
+		for (--steps; steps != 0; --steps)
+		{
+			current = current->next;
+		}
+	}
+	else
+	{
+		if (current == tail_node)
+		{
+			current = tail_node->prev;
+			--steps;
+		}
+		while (steps != 0 && current != node::from(current)->block_ptr()->first_node)
+		{
+			current = current->prev;
+			--steps;
+		}
+		if (steps == 0)
+		{
+			return iterator(current);
+		}
+
+		size_t target = node::from(current)->block_ptr()->index;
+		while (target > 0 && steps > block_index[target - 1].size)
+		{
+			steps -= block_index[target - 1].size;
+			--target;
+		}
+		if (target == 0)
+		{
+			return end();
+		}
+		current = block_index[target - 1].ptr->last_node;
+		for (--steps; steps != 0; --steps)
+		{
+			current = current->prev;
+		}
+	}
+	return iterator(current);
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+typename BucketStorage< T, Allocator, BlockCapacity >::handle
+	BucketStorage< T, Allocator, BlockCapacity >::get_handle(const_iterator it) const noexcept
+{
+	const links* position = reinterpret_cast< const links* >(it.node);
+	if (position == tail_node)
+	{
+		return handle{};
+	}
+	const node* current = node::from(position);
+	const block* owner = block::from(current->block_ptr());
+	const size_t slot = current->position;
+	return handle{ static_cast< uint32_t >(owner->id), static_cast< uint32_t >(slot), current->generation };
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+T* BucketStorage< T, Allocator, BlockCapacity >::get(handle h)
+{
+	if (!static_cast< const BucketStorage& >(*this).get(h))
+	{
+		return nullptr;
+	}
+	return unshare(block_ids[h.block].ptr)->slots()[h.slot].data();
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+const T* BucketStorage< T, Allocator, BlockCapacity >::get(handle h) const noexcept
+{
+	// Generations start at 1, so the default handle and the one end() gives never resolve.
+	if (h.generation == 0 || h.block >= block_ids.size())
+	{
+		return nullptr;
+	}
+	const block* owner = block_ids[h.block].ptr;
+	if (!owner || h.slot >= owner->constructed || !owner->live(h.slot) ||
+		owner->slots()[h.slot].generation != h.generation)
+	{
+		return nullptr;
+	}
+	return owner->slots()[h.slot].data();
+}
+
+#if LABA3_BUCKET_STORAGE_STATS
+template< typename T, typename Allocator, size_t BlockCapacity >
+bucket_storage_stats BucketStorage< T, Allocator, BlockCapacity >::stats() const noexcept
+{
+	bucket_storage_stats result;
+	result.live_elements = _size;
+	result.empty_blocks = empty_blocks;
+	result.slot_capacity = total_capacity;
+	result.blocks_allocated_total = blocks_allocated_total;
+	result.blocks_freed_total = blocks_freed_total;
+	size_t block_bytes = 0;
+	for (const block_entry& entry : block_index)
+	{
+		if (entry.ptr)
+		{
+			const size_t capacity = entry.ptr->block_capacity;
+			++result.allocated_blocks;
+			++result.occupancy_histogram[entry.size == 0 ? 0 : (entry.size * 10 + capacity - 1) / capacity];
+			block_bytes += block::allocation_size(capacity);
+		}
+	}
+	result.element_bytes = total_capacity * sizeof(T);
+	result.metadata_bytes = block_bytes - result.element_bytes + block_index.capacity() * sizeof(block_entry) +
+							block_ids.capacity() * sizeof(block_id_entry);
+	return result;
+}
+#endif
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename Function >
+void BucketStorage< T, Allocator, BlockCapacity >::for_each_block(Function&& function)
+{
+	unshare_blocks();
+	for (const block_entry& entry : block_index)
+	{
+		if (entry.size != 0)
+		{
+			entry.ptr->for_each_live([&function](node& slot) { function(*slot.data()); });
+		}
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename Function >
+void BucketStorage< T, Allocator, BlockCapacity >::for_each_block(Function&& function) const
+{
+	for (const block_entry& entry : block_index)
+	{
+		if (entry.size != 0)
+		{
+			static_cast< const block* >(entry.ptr)->for_each_live([&function](const node& slot) {
+				function(static_cast< const T& >(*slot.data()));
+			});
+		}
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename Body >
+void BucketStorage< T, Allocator, BlockCapacity >::run_partitioned(size_t thread_count, Body&& body) const
+{
+	if (thread_count == 0)
+	{
+		thread_count = std::max< size_t >(1, std::thread::hardware_concurrency());
+	}
+	thread_count = std::min(thread_count, std::max< size_t >(1, block_index.size()));
+
+	std::vector< size_t > bounds(thread_count + 1, block_index.size());
+	bounds[0] = 0;
+	size_t seen = 0;
+	size_t part = 1;
+	for (size_t i = 0; i < block_index.size() && part < thread_count; ++i)
+	{
+		seen += block_index[i].size;
+		if (seen * thread_count >= _size * part)
+		{
+			bounds[part++] = i + 1;
+		}
+	}
+
+	std::vector< std::exception_ptr > errors(thread_count);
+	std::vector< std::thread > workers;
+	workers.reserve(thread_count - 1);
+	auto run = [&](size_t worker) {
+		try
+		{
+			body(bounds[worker], bounds[worker + 1], worker);
+		} catch (...)
+		{
+			errors[worker] = std::current_exception();
+		}
+	};
+	try
+	{
+		for (size_t worker = 1; worker < thread_count; ++worker)
+		{
+			workers.emplace_back(run, worker);
+		}
+	} catch (...)
+	{
+		for (std::thread& worker : workers)
+		{
+			worker.join();
+		}
+		throw;
+	}
+	run(0);
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	for (const std::exception_ptr& error : errors)
+	{
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename Function >
+void BucketStorage< T, Allocator, BlockCapacity >::parallel_for_each(Function&& function, size_t thread_count)
+{
+	unshare_blocks();
+	run_partitioned(thread_count, [this, &function](size_t first, size_t last, size_t) {
+		for (size_t i = first; i < last; ++i)
+		{
+			if (block_index[i].size != 0)
+			{
+				block_index[i].ptr->for_each_live([&function](node& slot) { function(*slot.data()); });
+			}
+		}
+	});
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename Function >
+void BucketStorage< T, Allocator, BlockCapacity >::parallel_for_each(Function&& function, size_t thread_count) const
+{
+	run_partitioned(thread_count, [this, &function](size_t first, size_t last, size_t) {
+		for (size_t i = first; i < last; ++i)
+		{
+			if (block_index[i].size != 0)
+			{
+				static_cast< const block* >(block_index[i].ptr)->for_each_live([&function](const node& slot) {
+					function(static_cast< const T& >(*slot.data()));
+				});
+			}
+		}
+	});
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename U, typename Reduce, typename Map >
+U
+	BucketStorage< T, Allocator, BlockCapacity >::parallel_reduce(
+		U init, Reduce reduce, Map map, size_t thread_count) const
+{
+	const size_t threads = thread_count == 0 ? std::thread::hardware_concurrency() : thread_count;
+	std::vector< std::optional< U > > partials(std::max< size_t >(1, threads));
+	run_partitioned(partials.size(), [this, &partials, &reduce, &map](size_t first, size_t last, size_t worker) {
+		std::optional< U >& partial = partials[worker];
+		for (size_t i = first; i < last; ++i)
+		{
+			if (block_index[i].size != 0)
+			{
+				static_cast< const block* >(block_index[i].ptr)->for_each_live([&](const node& slot) {
+					if (partial)
+					{
+						*partial = reduce(std::move(*partial), map(static_cast< const T& >(*slot.data())));
+					}
+					else
+					{
+						partial.emplace(map(static_cast< const T& >(*slot.data())));
+					}
+				});
+			}
+		}
+	});
+	for (std::optional< U >& partial : partials)
+	{
+		if (partial)
+		{
+			init = reduce(std::move(init), std::move(*partial));
+		}
+	}
+	return init;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::compact_memory() noexcept
+{
+	while (free_block && empty_blocks > retained_limit)
+	{
+		if (free_block->block_size == 0 && total_capacity - free_block->block_capacity >= reserved_capacity)
+		{
+			block* empty_block = free_block;
+			free_block = block::from(empty_block->next_free);
+			release_block(empty_block);
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+BucketStorage< T, Allocator, BlockCapacity >::BucketStorage(const BucketStorage< T, Allocator, BlockCapacity >& other) :
+	BucketStorage(other, alloc_traits::select_on_container_copy_construction(other.allocator))
+{
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+BucketStorage< T, Allocator, BlockCapacity >::BucketStorage(
+	const BucketStorage< T, Allocator, BlockCapacity >& other, const Allocator& allocator) :
+	BucketStorage(other, allocator, 0)
+{
+}
+
+// Copies are stamped with fresh generations counted on from last_generation, so that copy assignment can keep the
+// handles it invalidates from matching the new elements.
+template< typename T, typename Allocator, size_t BlockCapacity >
+BucketStorage< T, Allocator, BlockCapacity >::BucketStorage(
+	const BucketStorage& other, const Allocator& allocator, uint64_t last_generation) :
+	_size(0), block_capacity(other.block_capacity), growth_limit(other.growth_limit), total_capacity(0),
+	free_block(nullptr), block_index(index_allocator(allocator)), block_ids(id_allocator(allocator)), rare(nullptr),
+	free_block_id(no_block_id), last_generation(last_generation), shared_blocks(false), released_blocks(0),
+	empty_blocks(0), retained_limit(other.retained_limit), reserved_capacity(0), tail_node(nullptr),
+	allocator(allocator)
+{
+	init_tail();
+	if (other.empty())
+	{
+		return;
+	}
+
+	try
+	{
+		if constexpr (std::is_trivially_copyable_v< T >)
+		{
+			clone_blocks(other);
+		}
+		else
+		{
+			const links* current = other.tail_node->next;
+			insert_bulk(other._size, [&current](node* slot) {
+				slot->set_data(*node::from(current)->data());
+				current = current->next;
+			});
+		}
+	} catch (...)
+	{
+		destroy_blocks();
+		throw;
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::clone_blocks(const BucketStorage& other)
+{
+	block_index.reserve(other.block_index.size());
+	block_ids.reserve(other.block_index.size());
+	for (const block_entry& entry : other.block_index)
+	{
+		if (entry.size == 0)
+		{
+			continue;
+		}
+		const block* source = entry.ptr;
+		block* copy = block::create(source->block_capacity, allocator);
+		register_block(copy);
+		copy_slots(source, copy, [copy, source](const links* pointer) -> node* {
+			return pointer ? copy->slots() + (node::from(pointer) - source->slots()) : nullptr;
+		});
+		copy->for_each_live([this](node& slot) { slot.generation = ++last_generation; });
+		copy->index = block_index.size();
+		block_index.push_back(entry);
+		block_index.back().ptr = copy;
+		total_capacity += copy->block_capacity;
+	}
+
+	for (size_t i = block_index.size(); i-- > 0;)
+	{
+		if (!block_index[i].ptr->full())
+		{
+			push_free_block(block_index[i].ptr);
+		}
+	}
+	links* previous = tail_node;
+	for (const block_entry& entry : block_index)
+	{
+		previous->link(entry.ptr->first_node);
+		previous = entry.ptr->last_node;
+	}
+	previous->link(tail_node);
+	_size = other._size;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+template< typename Relocate >
+void
+	BucketStorage< T, Allocator, BlockCapacity >::copy_slots(
+		const block* source, block* copy, Relocate relocate) noexcept(
+	std::is_trivially_copyable_v< T >)
+{
+	if constexpr (std::is_trivially_copyable_v< T >)
+	{
+		const size_t words = block::occupancy_words(source->constructed);
+		const size_t slot_bytes = source->constructed * sizeof(node);
+		std::memcpy(static_cast< void* >(copy->slots()), static_cast< const void* >(source->slots()), slot_bytes);
+		std::memcpy(copy->occupancy(), source->occupancy(), words * sizeof(uint64_t));
+	}
+	copy->constructed = source->constructed;
+	copy->block_size = source->block_size;
+	copy->free_slots = relocate(source->free_slots);
+	copy->first_node = relocate(source->first_node);
+	copy->last_node = relocate(source->last_node);
+	for (size_t slot = 0; slot < source->constructed; ++slot)
+	{
+		const node& from = source->slots()[slot];
+		node& to = copy->slots()[slot];
+		if constexpr (!std::is_trivially_copyable_v< T >)
+		{
+			::new (static_cast< void* >(&to)) node();
+			to.position = from.position;
+			to.generation = from.generation;
+		}
+		if (source->live(slot))
+		{
+			to.prev = &from == source->first_node ? nullptr : relocate(from.prev);
+			to.next = &from == source->last_node ? nullptr : relocate(from.next);
+			if constexpr (!std::is_trivially_copyable_v< T >)
+			{
+				// Occupancy is published per slot so that a throwing copy leaves only constructed values for destroy to
+				// clean up.
+				to.set_data(*from.data());
+				copy->occupancy()[slot / 64] |= uint64_t(1) << (slot % 64);
+			}
+		}
+		else
+		{
+			to.next = relocate(from.next);
+		}
+	}
+}
+
+#if LABA3_BUCKET_STORAGE_MAPPING
+template< typename T, typename Allocator, size_t BlockCapacity >
+bucket_storage_file_header BucketStorage< T, Allocator, BlockCapacity >::file_layout() noexcept
+{
+	bucket_storage_file_header header;
+	std::memcpy(header.magic, "BUCKETS", sizeof(header.magic));
+	header.version = 4;
+	header.value_size = sizeof(T);
+	header.value_alignment = alignof(T);
+	header.node_size = sizeof(node);
+	header.slots_offset = block::slots_offset();
+	return header;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+constexpr size_t BucketStorage< T, Allocator, BlockCapacity >::file_blocks_offset(size_t block_count) noexcept
+{
+	const size_t directory_end = sizeof(bucket_storage_file_header) + block_count * sizeof(bucket_storage_file_block);
+	return (directory_end + file_alignment - 1) / file_alignment * file_alignment;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void BucketStorage< T, Allocator, BlockCapacity >::save(const std::string& path) const
+{
+	static_assert(std::is_trivially_copyable_v< T >, "save requires a trivially copyable value_type");
+	std::vector< const block* > sources;
+	for (const block_entry& entry : block_index)
+	{
+		if (entry.ptr && entry.size != 0)
+		{
+			sources.push_back(entry.ptr);
+		}
+	}
+	std::vector< bucket_storage_file_block > directory(sources.size());
+	uint64_t offset = file_blocks_offset(sources.size());
+	for (size_t i = 0; i < sources.size(); ++i)
+	{
+		directory[i] = bucket_storage_file_block{ offset, sources[i]->block_size, sources[i]->block_capacity };
+		offset += block::allocation_size(sources[i]->block_capacity);
+	}
+
+	bucket_storage_file_header header = file_layout();
+	header.length = offset;
+	header.block_count = sources.size();
+	header.size = _size;
+	header.last_generation = last_generation;
+	header.block_capacity = block_capacity;
+	header.growth_limit = growth_limit;
+
+	// Pointers are written relative to an address range reserved for the duration of the save, so a later load can
+	// usually map the file there without fixups. The range is picked well away from where malloc and the loader place
+	// their mappings.
+	std::random_device entropy;
+	const uintptr_t hint = (uintptr_t(1) << 44) + (entropy() % 4096) * (uintptr_t(1) << 30);
+	const int reservation_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+	void* reservation = ::mmap(reinterpret_cast< void* >(hint), header.length, PROT_NONE, reservation_flags, -1, 0);
+	if (reservation != MAP_FAILED && reservation != reinterpret_cast< void* >(hint))
+	{
+		::munmap(reservation, header.length);
+		reservation = ::mmap(nullptr, header.length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	}
+	if (reservation != MAP_FAILED)
+	{
+		header.base = reinterpret_cast< uintptr_t >(reservation);
+	}
+	struct reservation_guard
+	{
+		void* address;
+		size_t length;
+		~reservation_guard()
+		{
+			if (address != MAP_FAILED)
+			{
+				::munmap(address, length);
+			}
+		}
+	} guard{ reservation, header.length };
+	auto file_node = [&header, &directory, &sources](size_t i, const links* pointer) -> node* {
+		const size_t slot = static_cast< size_t >(node::from(pointer) - sources[i]->slots());
+		const uint64_t address = header.base + directory[i].offset + block::slots_offset() + slot * sizeof(node);
+		return reinterpret_cast< node* >(address);
+	};
+
+	// Storages loaded from path keep mapping its old contents, so the new file replaces it instead of being written in
+	// place.
+	const std::string staging = path + ".tmp";
+	std::ofstream file(staging, std::ios::binary | std::ios::trunc);
+	file.exceptions(std::ios::failbit | std::ios::badbit);
+	file.write(reinterpret_cast< const char* >(&header), sizeof(header));
+	const size_t directory_bytes = directory.size() * sizeof(bucket_storage_file_block);
+	file.write(reinterpret_cast< const char* >(directory.data()), static_cast< std::streamsize >(directory_bytes));
+	static constexpr char padding[file_alignment] = {};
+	const size_t padding_bytes = file_blocks_offset(sources.size()) - sizeof(header) - directory_bytes;
+	file.write(padding, static_cast< std::streamsize >(padding_bytes));
+
+	for (size_t i = 0; i < sources.size(); ++i)
+	{
+		const block* source = sources[i];
+		block* image = block::create(source->block_capacity, allocator);
+		copy_slots(source, image, [&file_node, i](const links* pointer) -> node* {
+			return pointer ? file_node(i, pointer) : nullptr;
+		});
+		node* const first = image->slots() + source->first_node->position;
+		node* const last = image->slots() + source->last_node->position;
+		first->prev = i == 0 ? nullptr : file_node(i - 1, sources[i - 1]->last_node);
+		last->next = i + 1 == sources.size() ? nullptr : file_node(i + 1, sources[i + 1]->first_node);
+		image->index = static_cast< uint32_t >(i);
+		image->id = static_cast< uint32_t >(i);
+		image->mapped = 1;
+		try
+		{
+			const size_t image_bytes = block::allocation_size(source->block_capacity);
+			file.write(reinterpret_cast< const char* >(image), static_cast< std::streamsize >(image_bytes));
+		} catch (...)
+		{
+			image->mapped = 0;
+			block::destroy(image, allocator);
+			throw;
+		}
+		image->mapped = 0;
+		block::destroy(image, allocator);
+	}
+	file.close();
+	if (std::rename(staging.c_str(), path.c_str()) != 0)
+	{
+		const int error = errno;
+		std::remove(staging.c_str());
+		throw std::system_error(error, std::generic_category(), path);
+	}
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+BucketStorage< T, Allocator, BlockCapacity >
+	BucketStorage< T, Allocator, BlockCapacity >::load_mapped(const std::string& path, const Allocator& allocator)
+{
+	static_assert(std::is_trivially_copyable_v< T >, "load_mapped requires a trivially copyable value_type");
+	const int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+	{
+		throw std::system_error(errno, std::generic_category(), path);
+	}
+	bucket_storage_file_header header;
+	const bucket_storage_file_header expected = file_layout();
+	struct stat status;
+	if (::pread(descriptor, &header, sizeof(header), 0) != static_cast< ssize_t >(sizeof(header)) ||
+		::fstat(descriptor, &status) != 0 ||
+		std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version ||
+		header.value_size != expected.value_size || header.value_alignment != expected.value_alignment ||
+		header.node_size != expected.node_size || header.slots_offset != expected.slots_offset ||
+		header.block_capacity == 0 || header.block_capacity > std::numeric_limits< uint32_t >::max() ||
+		(BlockCapacity != 0 && header.block_capacity != BlockCapacity) ||
+		header.block_count > header.length / sizeof(bucket_storage_file_block) ||
+		header.length < file_blocks_offset(header.block_count) ||
+		static_cast< uint64_t >(status.st_size) < header.length)
+	{
+		::close(descriptor);
+		throw std::runtime_error(path + ": not a compatible BucketStorage file");
+	}
+
+	void* address = ::mmap(
+		reinterpret_cast< void* >(header.base), header.length, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+	const int error = errno;
+	::close(descriptor);
+	if (address == MAP_FAILED)
+	{
+		throw std::system_error(error, std::generic_category(), path);
+	}
+
+	BucketStorage storage(header.block_capacity, allocator);
+	const size_t length = header.length;
+	// Snapshots share the mapping, so it is unmapped when its last owner lets go.
+	std::shared_ptr< void > mapping(address, [length](void* region) { ::munmap(region, length); }, allocator);
+	storage.rare_state().mappings.push_back(mapped_region{ std::move(mapping), length });
+
+	// Everything the storage will follow is checked before the first pointer is relocated.
+	unsigned char* bytes = static_cast< unsigned char* >(address);
+	const auto* directory = reinterpret_cast< const bucket_storage_file_block* >(bytes + sizeof(header));
+	auto loaded = [bytes, directory](size_t i) {
+		return reinterpret_cast< const block* >(bytes + directory[i].offset);
+	};
+	uint64_t next_offset = file_blocks_offset(header.block_count);
+	uint64_t size = 0;
+	for (size_t i = 0; i < header.block_count; ++i)
+	{
+		const bucket_storage_file_block& entry = directory[i];
+		if (entry.offset % file_alignment != 0 || entry.offset < next_offset || entry.size == 0 ||
+			entry.size > entry.capacity || entry.capacity > std::numeric_limits< uint32_t >::max() ||
+			(BlockCapacity != 0 && entry.capacity != BlockCapacity) ||
+			block::allocation_size(entry.capacity) > header.length ||
+			entry.offset > header.length - block::allocation_size(entry.capacity))
+		{
+			throw std::runtime_error(path + ": corrupted BucketStorage block directory");
+		}
+		next_offset = entry.offset + block::allocation_size(entry.capacity);
+		size += entry.size;
+	}
+	if (size != header.size)
+	{
+		throw std::runtime_error(path + ": corrupted BucketStorage block directory");
+	}
+	for (size_t i = 0; i < header.block_count; ++i)
+	{
+		const links* before = i == 0 ? nullptr : loaded(i - 1)->last_node;
+		const links* after = i + 1 == header.block_count ? nullptr : loaded(i + 1)->first_node;
+		if (loaded(i)->index != i || loaded(i)->id != i || loaded(i)->mapped != 1 ||
+			loaded(i)->references.load() != 1 ||
+			!valid_mapped_block(loaded(i), header, directory[i], before, after))
+		{
+			throw std::runtime_error(path + ": corrupted BucketStorage block");
+		}
+	}
+	storage.block_index.reserve(header.block_count);
+	storage.block_ids.reserve(header.block_count);
+	storage.set_max_block_capacity(header.growth_limit);
+	storage.attach_mapped(bytes, header);
+	return storage;
+}
+
+// Pointers in the file are addresses in the range the file was saved for, so they are checked as numbers against that
+// range and never dereferenced here.
+template< typename T, typename Allocator, size_t BlockCapacity >
+bool
+	BucketStorage< T, Allocator, BlockCapacity >::valid_mapped_block(
+		const block* loaded, const bucket_storage_file_header& header, const bucket_storage_file_block& entry,
+		const links* before, const links* after) noexcept
+{
+	if (loaded->block_capacity != entry.capacity || loaded->constructed > loaded->block_capacity ||
+		loaded->block_size > loaded->constructed || loaded->block_size != entry.size)
+	{
+		return false;
+	}
+	// Every live slot has been constructed, and the live count matches block_size.
+	const uint64_t* words = loaded->occupancy();
+	size_t live = 0;
+	for (size_t word = 0; word < block::occupancy_words(loaded->block_capacity); ++word)
+	{
+		const size_t first = word * 64;
+		const size_t built = loaded->constructed > first ? std::min< size_t >(loaded->constructed - first, 64) : 0;
+		const uint64_t constructed = built == 64 ? ~uint64_t(0) : (uint64_t(1) << built) - 1;
+		if ((words[word] & ~constructed) != 0)
+		{
+			return false;
+		}
+		live += static_cast< size_t >(std::popcount(words[word]));
+	}
+	if (live != loaded->block_size)
+	{
+		return false;
+	}
+
+	const node* slots = loaded->slots();
+	const uintptr_t first_slot = header.base + entry.offset + block::slots_offset();
+	auto slot_of = [first_slot, loaded](const links* pointer) -> size_t {
+		const uintptr_t offset = reinterpret_cast< uintptr_t >(pointer) - first_slot;
+		const bool in_slot = offset % sizeof(node) == 0 && offset / sizeof(node) < loaded->constructed;
+		return in_slot ? offset / sizeof(node) : no_slot;
+	};
+	auto pointer_to = [first_slot](size_t slot) {
+		return reinterpret_cast< const links* >(first_slot + slot * sizeof(node));
+	};
+	for (size_t slot = 0; slot < loaded->constructed; ++slot)
+	{
+		if (slots[slot].position != slot)
+		{
+			return false;
+		}
+	}
+
+	// The live slots form one chain from first_node to last_node whose back links agree, which rules out cycles, and
+	// the chain's ends link to the neighbouring blocks.
+	size_t current = slot_of(loaded->first_node);
+	const size_t last = slot_of(loaded->last_node);
+	if (current == no_slot || last == no_slot || slots[current].prev != before || slots[last].next != after)
+	{
+		return false;
+	}
+	for (size_t step = 1;; ++step)
+	{
+		if (!loaded->live(current) || slots[current].generation == 0 ||
+			slots[current].generation > header.last_generation)
+		{
+			return false;
+		}
+		if (step == loaded->block_size)
+		{
+			break;
+		}
+		const size_t next = slot_of(slots[current].next);
+		if (next == no_slot || slots[next].prev != pointer_to(current))
+		{
+			return false;
+		}
+		current = next;
+	}
+	if (current != last)
+	{
+		return false;
+	}
+
+	// The free list holds exactly the constructed slots that are not live.
+	size_t free = 0;
+	for (const links* pointer = loaded->free_slots; pointer; ++free)
+	{
+		const size_t slot = slot_of(pointer);
+		if (slot == no_slot || loaded->live(slot) || free == loaded->constructed - loaded->block_size)
+		{
+			return false;
+		}
+		pointer = slots[slot].next;
+	}
+	return free == loaded->constructed - loaded->block_size;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+void
+	BucketStorage< T, Allocator, BlockCapacity >::attach_mapped(
+		unsigned char* address, const bucket_storage_file_header& header) noexcept
+{
+	const uintptr_t delta = reinterpret_cast< uintptr_t >(address) - header.base;
+	auto shift = [delta]< typename Pointer >(Pointer* pointer) -> Pointer* {
+		return pointer ? reinterpret_cast< Pointer* >(reinterpret_cast< uintptr_t >(pointer) + delta) : nullptr;
+	};
+	const auto* directory = reinterpret_cast< const bucket_storage_file_block* >(address + sizeof(header));
+	for (size_t i = 0; i < header.block_count; ++i)
+	{
+		block* loaded = reinterpret_cast< block* >(address + directory[i].offset);
+		if (delta != 0)
+		{
+			loaded->free_slots = shift(loaded->free_slots);
+			loaded->first_node = shift(loaded->first_node);
+			loaded->last_node = shift(loaded->last_node);
+			for (node* slot = loaded->slots(); slot != loaded->slots() + loaded->constructed; ++slot)
+			{
+				slot->prev = shift(slot->prev);
+				slot->next = shift(slot->next);
+			}
+		}
+		block_index.push_back(block_entry{ loaded, directory[i].size });
+		block_ids.push_back(block_id_entry{ loaded, no_block_id });
+		total_capacity += directory[i].capacity;
+#if LABA3_BUCKET_STORAGE_STATS
+		++blocks_allocated_total;
+#endif
+	}
+	if (!block_index.empty())
+	{
+		tail_node->link(block_index.front().ptr->first_node);
+		block_index.back().ptr->last_node->link(tail_node);
+	}
+	for (size_t i = block_index.size(); i-- > 0;)
+	{
+		if (directory[i].size < directory[i].capacity)
+		{
+			push_free_block(block_index[i].ptr);
+		}
+	}
+	_size = header.size;
+	last_generation = header.last_generation;
+}
+#endif
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+BucketStorage< T, Allocator, BlockCapacity >::BucketStorage(
+	BucketStorage< T, Allocator, BlockCapacity >&& other) noexcept :
+	_size(other._size), block_capacity(other.block_capacity), growth_limit(other.growth_limit),
+	total_capacity(other.total_capacity), free_block(other.free_block), block_index(std::move(other.block_index)),
+	block_ids(std::move(other.block_ids)), rare(std::exchange(other.rare, nullptr)), free_block_id(other.free_block_id),
+	last_generation(other.last_generation),
+	shared_blocks(std::exchange(other.shared_blocks, false)), released_blocks(other.released_blocks),
+	empty_blocks(other.empty_blocks), retained_limit(other.retained_limit), reserved_capacity(other.reserved_capacity),
+	tail_node(nullptr), allocator(std::move(other.allocator))
+{
+	init_tail();
+	adopt_chain(other.tail_node);
+	other._size = 0;
+	other.total_capacity = 0;
+	other.free_block = nullptr;
+	other.forget_defragment_plan();
+	other.free_block_id = no_block_id;
+	other.released_blocks = 0;
+	other.empty_blocks = 0;
+	other.reserved_capacity = 0;
+#if LABA3_BUCKET_STORAGE_STATS
+	blocks_allocated_total = std::exchange(other.blocks_allocated_total, 0);
+	blocks_freed_total = std::exchange(other.blocks_freed_total, 0);
+#endif
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+BucketStorage< T, Allocator, BlockCapacity >&
+	BucketStorage< T, Allocator, BlockCapacity >::operator=(const BucketStorage< T, Allocator, BlockCapacity >& other)
+{
+	if (this != &other)
+	{
+		if constexpr (alloc_traits::propagate_on_container_copy_assignment::value)
+		{
+			BucketStorage< T, Allocator, BlockCapacity > temporary_copy(other, other.allocator, last_generation);
+			swap_members(temporary_copy);
+			using std::swap;
+			swap(allocator, temporary_copy.allocator);
+		}
+		else
+		{
+			BucketStorage< T, Allocator, BlockCapacity > temporary_copy(other, allocator, last_generation);
+			swap_members(temporary_copy);
+		}
+	}
+	return *this;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+BucketStorage< T, Allocator, BlockCapacity >&
+	BucketStorage< T, Allocator, BlockCapacity >::operator=(
+		BucketStorage< T, Allocator, BlockCapacity >&& other) noexcept(
+		alloc_traits::propagate_on_container_move_assignment::value || alloc_traits::is_always_equal::value)
+{
+	if (this != &other)
+	{
+		if constexpr (
+			!alloc_traits::propagate_on_container_move_assignment::value && !alloc_traits::is_always_equal::value)
+		{
+			if (allocator != other.allocator)
+			{
+				clear();
+				insert(std::make_move_iterator(other.begin()), std::make_move_iterator(other.end()));
+				other.clear();
+				return *this;
+			}
+		}
+		destroy_blocks();
+		drop_rare_state();
+		if constexpr (alloc_traits::propagate_on_container_move_assignment::value)
+		{
+			allocator = std::move(other.allocator);
+		}
+		block_capacity = other.block_capacity;
+		growth_limit = other.growth_limit;
+		_size = other._size;
+		total_capacity = other.total_capacity;
+		free_block = other.free_block;
+		block_index = std::move(other.block_index);
+		block_ids = std::move(other.block_ids);
+		rare = std::exchange(other.rare, nullptr);
+		free_block_id = other.free_block_id;
+		last_generation = other.last_generation;
+		shared_blocks = std::exchange(other.shared_blocks, false);
+		released_blocks = other.released_blocks;
+		empty_blocks = other.empty_blocks;
+		retained_limit = other.retained_limit;
+		reserved_capacity = other.reserved_capacity;
+		adopt_chain(other.tail_node);
+
+		other._size = 0;
+		other.total_capacity = 0;
+		other.free_block = nullptr;
+		other.forget_defragment_plan();
+		other.free_block_id = no_block_id;
+		other.released_blocks = 0;
+		other.empty_blocks = 0;
+		other.reserved_capacity = 0;
+#if LABA3_BUCKET_STORAGE_STATS
+		blocks_allocated_total = std::exchange(other.blocks_allocated_total, 0);
+		blocks_freed_total = std::exchange(other.blocks_freed_total, 0);
+#endif
+	}
+	return *this;
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity >
+BucketStorage< T, Allocator, BlockCapacity >::~BucketStorage()
+{
+	destroy_blocks();
+	drop_rare_state();
+}
+
+template< typename T, typename Allocator, size_t BlockCapacity, typename Predicate >
+size_t erase_if(BucketStorage< T, Allocator, BlockCapacity >& storage, Predicate predicate)
+{
+	return storage.erase_matching(predicate);
+}
+
+template< typename T, typename Allocator = std::allocator< T >, size_t BlockCapacity = 64 >
+using FixedBucketStorage = BucketStorage< T, Allocator, BlockCapacity >;
+
+namespace pmr
+{
+	template< typename T, size_t BlockCapacity = 0 >
+	using BucketStorage = ::BucketStorage< T, std::pmr::polymorphic_allocator< T >, BlockCapacity >;
+}	 // namespace pmr
+
+#endif	  // LABA3_BUCKET_STORAGE_HPP
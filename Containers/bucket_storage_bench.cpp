@@ -0,0 +1,1211 @@
+#include "bucket_storage.hpp"
+#include "colony_baseline.h"
+#include "concurrent_bucket_storage.hpp"
+
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+static void BM_insert_sizet(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	for (auto _ : state)
+	{
+		BucketStorage< size_t > b;
+		for (size_t i = 0; i < n; ++i)
+			b.insert(i);
+		benchmark::DoNotOptimize(b.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_insert_sizet)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20);
+
+static void BM_insert_string(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	const std::string value(8, 'x');
+	for (auto _ : state)
+	{
+		BucketStorage< std::string > b;
+		for (size_t i = 0; i < n; ++i)
+			b.insert(value);
+		benchmark::DoNotOptimize(b.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_insert_string)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20);
+
+static void BM_empty_construct_destroy(benchmark::State &state)
+{
+	for (auto _ : state)
+	{
+		BucketStorage< std::string > b;
+		BucketStorage< std::string > moved = std::move(b);
+		benchmark::DoNotOptimize(moved.begin());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+BENCHMARK(BM_empty_construct_destroy);
+
+static void BM_iterate_sizet(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< size_t > b;
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	for (auto _ : state)
+	{
+		size_t sum = 0;
+		for (size_t value : b)
+			sum += value;
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_iterate_sizet)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20);
+
+static std::vector< ptrdiff_t > random_offsets(size_t n, size_t count)
+{
+	std::mt19937_64 rng(42);
+	std::uniform_int_distribution< size_t > dist(0, n - 1);
+	std::vector< ptrdiff_t > offsets(count);
+	for (ptrdiff_t &offset : offsets)
+		offset = static_cast< ptrdiff_t >(dist(rng));
+	return offsets;
+}
+
+static void BM_get_to_distance(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< size_t > b;
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	const std::vector< ptrdiff_t > offsets = random_offsets(n, 1024);
+	size_t k = 0;
+	for (auto _ : state)
+	{
+		const ptrdiff_t offset = offsets[k++ % offsets.size()];
+		benchmark::DoNotOptimize(*b.get_to_distance(b.begin(), offset));
+		benchmark::DoNotOptimize(*b.get_to_distance(b.end(), -1 - offset));
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * 2));
+}
+BENCHMARK(BM_get_to_distance)->Arg(1 << 20)->Arg(10000000);
+
+static void BM_linear_advance(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< size_t > b;
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	const std::vector< ptrdiff_t > offsets = random_offsets(n, 1024);
+	size_t k = 0;
+	for (auto _ : state)
+	{
+		const ptrdiff_t offset = offsets[k++ % offsets.size()];
+		benchmark::DoNotOptimize(*std::next(b.begin(), offset));
+		benchmark::DoNotOptimize(*std::prev(b.end(), 1 + offset));
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * 2));
+}
+BENCHMARK(BM_linear_advance)->Arg(1 << 20)->Arg(10000000);
+
+static void BM_handle_lookup(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< size_t > b;
+	std::vector< BucketStorage< size_t >::handle > handles;
+	handles.reserve(n);
+	for (size_t i = 0; i < n; ++i)
+		handles.push_back(b.get_handle(b.insert(i)));
+	std::mt19937_64 rng(11);
+	for (BucketStorage< size_t >::iterator it = b.begin(); it != b.end();)
+		it = rng() % 4 == 0 ? b.erase(it) : std::next(it);
+	std::shuffle(handles.begin(), handles.end(), rng);
+	size_t k = 0;
+	for (auto _ : state)
+	{
+		const size_t *value = b.get(handles[k++ % n]);
+		benchmark::DoNotOptimize(value ? *value : 0);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+BENCHMARK(BM_handle_lookup)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20);
+
+static void BM_pointer_lookup(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< size_t > b;
+	std::vector< const size_t * > pointers;
+	pointers.reserve(n);
+	for (size_t i = 0; i < n; ++i)
+		pointers.push_back(&*b.insert(i));
+	std::mt19937_64 rng(11);
+	std::shuffle(pointers.begin(), pointers.end(), rng);
+	size_t k = 0;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(*pointers[k++ % n]);
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+BENCHMARK(BM_pointer_lookup)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20);
+
+static BucketStorage< size_t > churned_storage(size_t n)
+{
+	BucketStorage< size_t > b;
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	std::mt19937_64 rng(7);
+	for (size_t round = 0; round < 4; ++round)
+	{
+		for (BucketStorage< size_t >::iterator it = b.begin(); it != b.end();)
+			it = (rng() & 1) ? b.erase(it) : std::next(it);
+		while (b.size() < n)
+			b.insert(rng() % n);
+	}
+	return b;
+}
+
+static void BM_scan_list_order_after_churn(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	const BucketStorage< size_t > b = churned_storage(n);
+	for (auto _ : state)
+	{
+		size_t sum = 0;
+		for (size_t value : b)
+			sum += value;
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_scan_list_order_after_churn)->Arg(1 << 16)->Arg(1 << 20);
+
+static void BM_scan_block_order_after_churn(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	const BucketStorage< size_t > b = churned_storage(n);
+	for (auto _ : state)
+	{
+		size_t sum = 0;
+		b.for_each_block([&sum](size_t value) { sum += value; });
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_scan_block_order_after_churn)->Arg(1 << 16)->Arg(1 << 20);
+
+static BucketStorage< size_t > storage_with_occupancy(size_t n, int64_t percent)
+{
+	BucketStorage< size_t > b;
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	std::mt19937_64 rng(13);
+	for (BucketStorage< size_t >::iterator it = b.begin(); it != b.end();)
+		it = static_cast< int64_t >(rng() % 100) >= percent ? b.erase(it) : std::next(it);
+	return b;
+}
+
+static void BM_scan_block_order_occupancy(benchmark::State &state)
+{
+	const BucketStorage< size_t > b = storage_with_occupancy(1 << 20, state.range(0));
+	for (auto _ : state)
+	{
+		size_t sum = 0;
+		b.for_each_block([&sum](size_t value) { sum += value; });
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * b.size()));
+}
+BENCHMARK(BM_scan_block_order_occupancy)->Arg(10)->Arg(50)->Arg(90);
+
+static void BM_scan_list_order_occupancy(benchmark::State &state)
+{
+	const BucketStorage< size_t > b = storage_with_occupancy(1 << 20, state.range(0));
+	for (auto _ : state)
+	{
+		size_t sum = 0;
+		for (size_t value : b)
+			sum += value;
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * b.size()));
+}
+BENCHMARK(BM_scan_list_order_occupancy)->Arg(10)->Arg(50)->Arg(90);
+
+class counting_resource : public std::pmr::memory_resource
+{
+  public:
+	size_t bytes = 0;
+	size_t allocations = 0;
+
+  private:
+	void *do_allocate(size_t size, size_t alignment) override
+	{
+		bytes += size;
+		++allocations;
+		return std::pmr::new_delete_resource()->allocate(size, alignment);
+	}
+	void do_deallocate(void *p, size_t size, size_t alignment) override
+	{
+		bytes -= size;
+		std::pmr::new_delete_resource()->deallocate(p, size, alignment);
+	}
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+template< typename T >
+static void BM_footprint(benchmark::State &state)
+{
+	const size_t n = 1 << 20;
+	counting_resource resource;
+	pmr::BucketStorage< T > b{ std::pmr::polymorphic_allocator< T >(&resource) };
+	for (size_t i = 0; i < n; ++i)
+		b.insert(static_cast< T >(i));
+	for (auto _ : state)
+	{
+		size_t sum = 0;
+		b.for_each_block([&sum](const T &value) { sum += static_cast< size_t >(value); });
+		benchmark::DoNotOptimize(sum);
+	}
+	state.counters["bytes_per_element"] = static_cast< double >(resource.bytes) / static_cast< double >(n);
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK_TEMPLATE(BM_footprint, uint32_t);
+BENCHMARK_TEMPLATE(BM_footprint, size_t);
+
+static void BM_parallel_reduce(benchmark::State &state)
+{
+	const size_t n = 10000000;
+	BucketStorage< size_t > b;
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	const size_t threads = static_cast< size_t >(state.range(0));
+	for (auto _ : state)
+	{
+		const size_t sum = b.parallel_reduce(
+			size_t(0),
+			[](size_t lhs, size_t rhs) { return lhs + rhs; },
+			[](size_t value) { return value; },
+			threads);
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_parallel_reduce)->RangeMultiplier(2)->Range(1, 32)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+static void BM_bulk_load_single_inserts(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	std::vector< size_t > values(n);
+	for (size_t i = 0; i < n; ++i)
+		values[i] = i;
+	for (auto _ : state)
+	{
+		BucketStorage< size_t > b;
+		for (size_t value : values)
+			b.insert(value);
+		benchmark::DoNotOptimize(b.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_bulk_load_single_inserts)->Arg(1 << 20)->Arg(10000000)->Unit(benchmark::kMillisecond);
+
+static void BM_bulk_load_range_insert(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	std::vector< size_t > values(n);
+	for (size_t i = 0; i < n; ++i)
+		values[i] = i;
+	for (auto _ : state)
+	{
+		BucketStorage< size_t > b;
+		b.insert(values.begin(), values.end());
+		benchmark::DoNotOptimize(b.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_bulk_load_range_insert)->Arg(1 << 20)->Arg(10000000)->Unit(benchmark::kMillisecond);
+
+static void BM_fill_drain_cycle(benchmark::State &state)
+{
+	const size_t n = 1 << 16;
+	BucketStorage< size_t > b;
+	if (state.range(0) != 0)
+	{
+		b.set_retained_blocks(n / 64);
+		b.reserve(n);
+	}
+	for (auto _ : state)
+	{
+		for (size_t i = 0; i < n; ++i)
+			b.insert(i);
+		while (!b.empty())
+			b.erase(b.begin());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_fill_drain_cycle)->Arg(0)->Arg(1);
+
+static std::vector< BucketStorage< size_t > > worker_storages(size_t parts, size_t n)
+{
+	std::vector< BucketStorage< size_t > > storages(parts);
+	for (size_t part = 0; part < parts; ++part)
+		storages[part].insert_n(n, part);
+	return storages;
+}
+
+static void BM_merge_splice(benchmark::State &state)
+{
+	const size_t parts = static_cast< size_t >(state.range(0));
+	const size_t n = static_cast< size_t >(state.range(1));
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		std::vector< BucketStorage< size_t > > storages = worker_storages(parts, n);
+		BucketStorage< size_t > merged;
+		state.ResumeTiming();
+		for (BucketStorage< size_t > &part : storages)
+			merged.splice(std::move(part));
+		benchmark::DoNotOptimize(merged.size());
+		state.PauseTiming();
+		storages.clear();
+		merged.clear();
+		state.ResumeTiming();
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * parts * n));
+}
+BENCHMARK(BM_merge_splice)->Args({ 32, 1 << 20 })->Unit(benchmark::kMillisecond)->Iterations(3);
+
+static void BM_merge_insert(benchmark::State &state)
+{
+	const size_t parts = static_cast< size_t >(state.range(0));
+	const size_t n = static_cast< size_t >(state.range(1));
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		std::vector< BucketStorage< size_t > > storages = worker_storages(parts, n);
+		BucketStorage< size_t > merged;
+		state.ResumeTiming();
+		for (BucketStorage< size_t > &part : storages)
+		{
+			merged.insert(part.begin(), part.end());
+			part.clear();
+		}
+		benchmark::DoNotOptimize(merged.size());
+		state.PauseTiming();
+		storages.clear();
+		merged.clear();
+		state.ResumeTiming();
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * parts * n));
+}
+BENCHMARK(BM_merge_insert)->Args({ 32, 1 << 20 })->Unit(benchmark::kMillisecond)->Iterations(3);
+
+template< typename Storage >
+static void capacity_workload(benchmark::State &state, Storage &b)
+{
+	const size_t n = 1 << 16;
+	for (auto _ : state)
+	{
+		for (size_t i = 0; i < n; ++i)
+			b.insert(i);
+		erase_if(b, [](size_t value) { return value % 3 == 0; });
+		size_t sum = 0;
+		b.for_each_block([&sum](size_t value) { sum += value; });
+		benchmark::DoNotOptimize(sum);
+		b.shrink_to_fit();
+		b.clear();
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+
+template< size_t Capacity >
+static void BM_runtime_capacity(benchmark::State &state)
+{
+	BucketStorage< size_t > b(Capacity);
+	capacity_workload(state, b);
+}
+BENCHMARK_TEMPLATE(BM_runtime_capacity, 16);
+BENCHMARK_TEMPLATE(BM_runtime_capacity, 64);
+BENCHMARK_TEMPLATE(BM_runtime_capacity, 1024);
+
+template< size_t Capacity >
+static void BM_fixed_capacity(benchmark::State &state)
+{
+	FixedBucketStorage< size_t, std::allocator< size_t >, Capacity > b;
+	capacity_workload(state, b);
+}
+BENCHMARK_TEMPLATE(BM_fixed_capacity, 16);
+BENCHMARK_TEMPLATE(BM_fixed_capacity, 64);
+BENCHMARK_TEMPLATE(BM_fixed_capacity, 1024);
+
+static void BM_block_growth(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	counting_resource resource;
+	pmr::BucketStorage< size_t > b(64, std::pmr::polymorphic_allocator< size_t >(&resource));
+	b.set_max_block_capacity(static_cast< size_t >(state.range(1)));
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	for (auto _ : state)
+	{
+		size_t sum = 0;
+		for (size_t value : b)
+			sum += value;
+		benchmark::DoNotOptimize(sum);
+	}
+	state.counters["allocations"] = static_cast< double >(resource.allocations);
+	state.counters["bytes_per_element"] = static_cast< double >(resource.bytes) / static_cast< double >(n);
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_block_growth)->ArgsProduct({ { 10, 1000, 100000, 10000000, 100000000 }, { 64, 1 << 16 } });
+
+#if LABA3_BUCKET_STORAGE_MAPPING
+static std::string saved_storage(size_t n)
+{
+	const std::string path = (std::filesystem::temp_directory_path() / ("bucket_storage_bench_" + std::to_string(n) + ".bin")).string();
+	BucketStorage< size_t > b(64);
+	b.set_max_block_capacity(1 << 16);
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	b.save(path);
+	return path;
+}
+
+static void drop_page_cache(const std::string &path)
+{
+	const int descriptor = ::open(path.c_str(), O_RDONLY);
+	::posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED);
+	::close(descriptor);
+}
+
+static void BM_cold_start_load_mapped(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	const std::string path = saved_storage(n);
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		drop_page_cache(path);
+		state.ResumeTiming();
+		BucketStorage< size_t > b = BucketStorage< size_t >::load_mapped(path);
+		benchmark::DoNotOptimize(*b.begin());
+	}
+	std::filesystem::remove(path);
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_cold_start_load_mapped)->Arg(1 << 20)->Arg(10000000)->Arg(100000000)->Unit(benchmark::kMillisecond);
+
+static void BM_cold_start_load_mapped_scan(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	const std::string path = saved_storage(n);
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		drop_page_cache(path);
+		state.ResumeTiming();
+		BucketStorage< size_t > b = BucketStorage< size_t >::load_mapped(path);
+		size_t sum = 0;
+		b.for_each_block([&sum](size_t value) { sum += value; });
+		benchmark::DoNotOptimize(sum);
+	}
+	std::filesystem::remove(path);
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_cold_start_load_mapped_scan)->Arg(1 << 20)->Arg(10000000)->Arg(100000000)->Unit(benchmark::kMillisecond);
+
+static void BM_cold_start_reinsert(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	for (auto _ : state)
+	{
+		BucketStorage< size_t > b(64);
+		b.set_max_block_capacity(1 << 16);
+		for (size_t i = 0; i < n; ++i)
+			b.insert(i);
+		benchmark::DoNotOptimize(*b.begin());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_cold_start_reinsert)->Arg(1 << 20)->Arg(10000000)->Arg(100000000)->Unit(benchmark::kMillisecond);
+#endif
+
+static void BM_snapshot_take(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< size_t > b(64);
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	for (auto _ : state)
+	{
+		BucketStorage< size_t >::snapshot_type view = b.snapshot();
+		benchmark::DoNotOptimize(view.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_snapshot_take)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20)->Arg(10000000)->Unit(benchmark::kMicrosecond);
+
+static void BM_snapshot_copy_baseline(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< size_t > b(64);
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	for (auto _ : state)
+	{
+		BucketStorage< size_t > copy(b);
+		benchmark::DoNotOptimize(copy.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_snapshot_copy_baseline)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20)->Arg(10000000)->Unit(benchmark::kMicrosecond);
+
+// Random erase plus insert while a reader snapshot is retaken every `interval` writes (0 keeps no snapshot at all).
+static void BM_snapshot_writer_churn(benchmark::State &state)
+{
+	const size_t n = 1 << 16;
+	const size_t block = static_cast< size_t >(state.range(0));
+	const size_t interval = static_cast< size_t >(state.range(1));
+	BucketStorage< size_t > b(block);
+	for (size_t i = 0; i < n; ++i)
+		b.insert(i);
+	std::mt19937_64 rng(42);
+	std::optional< BucketStorage< size_t >::snapshot_type > view;
+#if LABA3_BUCKET_STORAGE_STATS
+	const size_t allocated = b.stats().blocks_allocated_total;
+#endif
+	size_t writes = 0;
+	for (auto _ : state)
+	{
+		if (interval != 0 && writes % interval == 0)
+		{
+			view.reset();
+			view.emplace(b.snapshot());
+		}
+		b.erase(b.get_to_distance(b.begin(), static_cast< ptrdiff_t >(rng() % b.size())));
+		b.insert(writes++);
+	}
+#if LABA3_BUCKET_STORAGE_STATS
+	state.counters["copied_blocks"] = benchmark::Counter(static_cast< double >(b.stats().blocks_allocated_total - allocated), benchmark::Counter::kAvgIterations);
+#endif
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+BENCHMARK(BM_snapshot_writer_churn)->ArgsProduct({ { 64, 1024 }, { 0, 100, 10000 } });
+
+struct pod_record
+{
+	size_t key;
+	double weight;
+	uint32_t flags;
+};
+
+template< typename T >
+static T make_value(size_t i)
+{
+	if constexpr (std::is_same_v< T, std::string >)
+		return std::to_string(i);
+	else if constexpr (std::is_same_v< T, pod_record >)
+		return pod_record{ i, static_cast< double >(i), static_cast< uint32_t >(i) };
+	else
+		return static_cast< T >(i);
+}
+
+template< typename T >
+static void fill(BucketStorage< T > &b, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		b.insert(make_value< T >(i));
+}
+
+template< typename T >
+static void BM_copy(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< T > b;
+	fill(b, n);
+	for (auto _ : state)
+	{
+		BucketStorage< T > copy = b;
+		benchmark::DoNotOptimize(copy.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK_TEMPLATE(BM_copy, size_t)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_copy, pod_record)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_copy, std::string)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+
+template< typename T >
+static void BM_clear(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< T > b;
+	b.set_retained_blocks(n / 64);
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		fill(b, n);
+		state.ResumeTiming();
+		b.clear();
+		benchmark::DoNotOptimize(b.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK_TEMPLATE(BM_clear, size_t)->Arg(1 << 20)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_clear, pod_record)->Arg(1 << 20)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_clear, std::string)->Arg(1 << 20)->Unit(benchmark::kMicrosecond);
+
+template< typename T >
+static void BM_destroy(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		BucketStorage< T > *b = new BucketStorage< T >();
+		fill(*b, n);
+		state.ResumeTiming();
+		delete b;
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK_TEMPLATE(BM_destroy, size_t)->Arg(1 << 20)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_destroy, pod_record)->Arg(1 << 20)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_destroy, std::string)->Arg(1 << 20)->Unit(benchmark::kMicrosecond);
+
+template< typename T >
+static void BM_erase_all(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< T > b;
+	b.set_retained_blocks(n / 64);
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		fill(b, n);
+		state.ResumeTiming();
+		for (typename BucketStorage< T >::iterator it = b.begin(); it != b.end();)
+			it = b.erase(it);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK_TEMPLATE(BM_erase_all, size_t)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_erase_all, pod_record)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_erase_all, std::string)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+
+static void BM_shrink_to_fit_after_churn(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	BucketStorage< std::string > b;
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		b.clear();
+		for (size_t i = 0; i < n; ++i)
+			b.insert(std::to_string(i));
+		std::mt19937_64 rng(3);
+		for (BucketStorage< std::string >::iterator it = b.begin(); it != b.end();)
+			it = (rng() % 4 != 0) ? b.erase(it) : std::next(it);
+		state.ResumeTiming();
+		b.shrink_to_fit();
+		benchmark::DoNotOptimize(b.capacity());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_shrink_to_fit_after_churn)->Arg(1 << 20)->Unit(benchmark::kMillisecond);
+
+static void BM_defragment_slice(benchmark::State &state)
+{
+	const size_t budget = static_cast< size_t >(state.range(0));
+	BucketStorage< size_t > b;
+	size_t moved = 0;
+	for (auto _ : state)
+	{
+		if (moved == 0)
+		{
+			state.PauseTiming();
+			b = storage_with_occupancy(1 << 18, 10);
+			state.ResumeTiming();
+		}
+		moved = b.defragment(budget, [](BucketStorage< size_t >::const_iterator, BucketStorage< size_t >::iterator) {});
+		benchmark::DoNotOptimize(moved);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * budget));
+}
+BENCHMARK(BM_defragment_slice)->Arg(64)->Arg(1024)->Arg(16384)->Unit(benchmark::kMicrosecond);
+
+static void BM_purge_single_erases(benchmark::State &state)
+{
+	const size_t n = 1 << 20;
+	const size_t percent = static_cast< size_t >(state.range(0));
+	BucketStorage< size_t > b;
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		b.clear();
+		for (size_t i = 0; i < n; ++i)
+			b.insert(i);
+		state.ResumeTiming();
+		for (BucketStorage< size_t >::iterator it = b.begin(); it != b.end();)
+			it = (*it * 2654435761u) % 100 < percent ? b.erase(it) : std::next(it);
+		benchmark::DoNotOptimize(b.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_purge_single_erases)->Arg(30)->Arg(50)->Unit(benchmark::kMillisecond);
+
+static void BM_purge_erase_if(benchmark::State &state)
+{
+	const size_t n = 1 << 20;
+	const size_t percent = static_cast< size_t >(state.range(0));
+	BucketStorage< size_t > b;
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		b.clear();
+		for (size_t i = 0; i < n; ++i)
+			b.insert(i);
+		state.ResumeTiming();
+		benchmark::DoNotOptimize(erase_if(b, [percent](size_t value) { return (value * 2654435761u) % 100 < percent; }));
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+BENCHMARK(BM_purge_erase_if)->Arg(30)->Arg(50)->Unit(benchmark::kMillisecond);
+
+static void BM_erase_range_single_erases(benchmark::State &state)
+{
+	const size_t n = 1 << 20;
+	BucketStorage< size_t > b;
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		b.clear();
+		for (size_t i = 0; i < n; ++i)
+			b.insert(i);
+		BucketStorage< size_t >::iterator it = b.get_to_distance(b.begin(), n / 4);
+		BucketStorage< size_t >::iterator last = b.get_to_distance(b.begin(), 3 * n / 4);
+		state.ResumeTiming();
+		while (it != last)
+			it = b.erase(it);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n / 2));
+}
+BENCHMARK(BM_erase_range_single_erases)->Unit(benchmark::kMillisecond);
+
+static void BM_erase_range(benchmark::State &state)
+{
+	const size_t n = 1 << 20;
+	BucketStorage< size_t > b;
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		b.clear();
+		for (size_t i = 0; i < n; ++i)
+			b.insert(i);
+		BucketStorage< size_t >::iterator first = b.get_to_distance(b.begin(), n / 4);
+		BucketStorage< size_t >::iterator last = b.get_to_distance(b.begin(), 3 * n / 4);
+		state.ResumeTiming();
+		b.erase(first, last);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n / 2));
+}
+BENCHMARK(BM_erase_range)->Unit(benchmark::kMillisecond);
+
+template< typename Container >
+struct container_ops
+{
+	using handle = typename Container::iterator;
+	static handle insert(Container &c, size_t value) { return c.insert(value); }
+	static void erase(Container &c, handle h) { c.erase(h); }
+	static constexpr bool stable_handles = true;
+};
+
+template<>
+struct container_ops< std::list< size_t > >
+{
+	using handle = std::list< size_t >::iterator;
+	static handle insert(std::list< size_t > &c, size_t value) { return c.insert(c.end(), value); }
+	static void erase(std::list< size_t > &c, handle h) { c.erase(h); }
+	static constexpr bool stable_handles = true;
+};
+
+template<>
+struct container_ops< std::deque< size_t > >
+{
+	using handle = size_t;
+	static handle insert(std::deque< size_t > &c, size_t value)
+	{
+		c.push_back(value);
+		return c.size() - 1;
+	}
+	static void erase(std::deque< size_t > &c, handle h) { c.erase(c.begin() + static_cast< ptrdiff_t >(h)); }
+	static constexpr bool stable_handles = false;
+};
+
+using bucket_storage_t = BucketStorage< size_t >;
+using list_t = std::list< size_t >;
+using deque_t = std::deque< size_t >;
+using colony_t = ColonyBaseline< size_t >;
+
+template< typename Container >
+static std::vector< typename container_ops< Container >::handle > fill_container(Container &c, size_t n)
+{
+	std::vector< typename container_ops< Container >::handle > handles;
+	handles.reserve(n);
+	for (size_t i = 0; i < n; ++i)
+		handles.push_back(container_ops< Container >::insert(c, i));
+	return handles;
+}
+
+template< typename Container >
+static void erase_random(Container &c, std::vector< typename container_ops< Container >::handle > &handles, std::mt19937_64 &rng)
+{
+	if constexpr (container_ops< Container >::stable_handles)
+	{
+		const size_t k = rng() % handles.size();
+		container_ops< Container >::erase(c, handles[k]);
+		handles[k] = handles.back();
+		handles.pop_back();
+	}
+	else
+	{
+		container_ops< Container >::erase(c, rng() % c.size());
+		handles.pop_back();
+	}
+}
+
+static void suite_sizes(benchmark::internal::Benchmark *b)
+{
+	b->Arg(1 << 10)->Arg(1 << 15)->Arg(1 << 20)->Arg(10000000)->Unit(benchmark::kMicrosecond);
+}
+
+static void small_suite_sizes(benchmark::internal::Benchmark *b)
+{
+	b->Arg(1 << 10)->Arg(1 << 15)->Unit(benchmark::kMicrosecond);
+}
+
+template< typename Container >
+static void BM_suite_insert(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	for (auto _ : state)
+	{
+		Container c;
+		for (size_t i = 0; i < n; ++i)
+			container_ops< Container >::insert(c, i);
+		benchmark::DoNotOptimize(c.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+
+template< typename Container >
+static void BM_suite_erase_random(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	std::mt19937_64 rng(11);
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		Container c;
+		std::vector< typename container_ops< Container >::handle > handles = fill_container(c, n);
+		state.ResumeTiming();
+		for (size_t i = 0; i < n / 2; ++i)
+			erase_random(c, handles, rng);
+		benchmark::DoNotOptimize(c.size());
+		state.PauseTiming();
+		c = Container();
+		state.ResumeTiming();
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * (n / 2)));
+}
+
+template< typename Container >
+static void BM_suite_iterate(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	Container c;
+	fill_container(c, n);
+	for (auto _ : state)
+	{
+		size_t sum = 0;
+		for (size_t value : c)
+			sum += value;
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+
+template< typename Container >
+static void BM_suite_copy(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	Container c;
+	fill_container(c, n);
+	for (auto _ : state)
+	{
+		Container copy = c;
+		benchmark::DoNotOptimize(copy.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+
+template< typename Container >
+static void BM_suite_move(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	Container c;
+	fill_container(c, n);
+	for (auto _ : state)
+	{
+		Container moved = std::move(c);
+		benchmark::DoNotOptimize(moved.size());
+		c = std::move(moved);
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+
+template< typename Container >
+static void BM_suite_clear(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	Container c;
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		fill_container(c, n);
+		state.ResumeTiming();
+		c.clear();
+		benchmark::DoNotOptimize(c.size());
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * n));
+}
+
+template< typename Container >
+static void BM_suite_churn(benchmark::State &state)
+{
+	const size_t n = static_cast< size_t >(state.range(0));
+	Container c;
+	std::vector< typename container_ops< Container >::handle > handles = fill_container(c, n);
+	std::mt19937_64 rng(5);
+	size_t value = n;
+	for (auto _ : state)
+	{
+		erase_random(c, handles, rng);
+		handles.push_back(container_ops< Container >::insert(c, value++));
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * 2));
+}
+
+#define SUITE_FOR_ALL(function, sizes)                                                                                 \
+	BENCHMARK_TEMPLATE(function, bucket_storage_t)->Apply(sizes);                                                      \
+	BENCHMARK_TEMPLATE(function, list_t)->Apply(sizes);                                                                \
+	BENCHMARK_TEMPLATE(function, deque_t)->Apply(sizes);                                                               \
+	BENCHMARK_TEMPLATE(function, colony_t)->Apply(sizes)
+
+SUITE_FOR_ALL(BM_suite_insert, suite_sizes);
+SUITE_FOR_ALL(BM_suite_iterate, suite_sizes);
+SUITE_FOR_ALL(BM_suite_copy, suite_sizes);
+SUITE_FOR_ALL(BM_suite_move, suite_sizes);
+SUITE_FOR_ALL(BM_suite_clear, suite_sizes);
+BENCHMARK_TEMPLATE(BM_suite_erase_random, bucket_storage_t)->Apply(suite_sizes);
+BENCHMARK_TEMPLATE(BM_suite_erase_random, list_t)->Apply(suite_sizes);
+BENCHMARK_TEMPLATE(BM_suite_erase_random, deque_t)->Apply(small_suite_sizes);
+BENCHMARK_TEMPLATE(BM_suite_erase_random, colony_t)->Apply(suite_sizes);
+BENCHMARK_TEMPLATE(BM_suite_churn, bucket_storage_t)->Apply(suite_sizes);
+BENCHMARK_TEMPLATE(BM_suite_churn, list_t)->Apply(suite_sizes);
+BENCHMARK_TEMPLATE(BM_suite_churn, deque_t)->Apply(small_suite_sizes);
+BENCHMARK_TEMPLATE(BM_suite_churn, colony_t)->Apply(suite_sizes);
+
+static ConcurrentBucketStorage< size_t > *shared_concurrent = nullptr;
+
+static void BM_concurrent_insert_erase(benchmark::State &state)
+{
+	if (state.thread_index() == 0)
+		shared_concurrent = new ConcurrentBucketStorage< size_t >();
+	std::vector< ConcurrentBucketStorage< size_t >::handle > local;
+	local.reserve(256);
+	for (auto _ : state)
+	{
+		for (size_t i = 0; i < 256; ++i)
+			local.push_back(shared_concurrent->insert(i));
+		for (const ConcurrentBucketStorage< size_t >::handle &h : local)
+			shared_concurrent->erase(h);
+		local.clear();
+	}
+	if (state.thread_index() == 0)
+	{
+		delete shared_concurrent;
+		shared_concurrent = nullptr;
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * 512));
+}
+BENCHMARK(BM_concurrent_insert_erase)->ThreadRange(1, 32)->UseRealTime();
+
+static ConcurrentBucketStorage< size_t > *other_concurrent = nullptr;
+
+// Every thread alternates between two storages, so each insert and erase switches the storage it works on.
+static void BM_concurrent_two_storages(benchmark::State &state)
+{
+	if (state.thread_index() == 0)
+	{
+		shared_concurrent = new ConcurrentBucketStorage< size_t >();
+		other_concurrent = new ConcurrentBucketStorage< size_t >();
+	}
+	std::vector< ConcurrentBucketStorage< size_t >::handle > local;
+	std::vector< ConcurrentBucketStorage< size_t >::handle > other;
+	local.reserve(128);
+	other.reserve(128);
+	for (auto _ : state)
+	{
+		for (size_t i = 0; i < 128; ++i)
+		{
+			local.push_back(shared_concurrent->insert(i));
+			other.push_back(other_concurrent->insert(i));
+		}
+		for (size_t i = 0; i < 128; ++i)
+		{
+			shared_concurrent->erase(local[i]);
+			other_concurrent->erase(other[i]);
+		}
+		local.clear();
+		other.clear();
+	}
+	if (state.thread_index() == 0)
+	{
+		delete shared_concurrent;
+		delete other_concurrent;
+		shared_concurrent = nullptr;
+		other_concurrent = nullptr;
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * 512));
+}
+BENCHMARK(BM_concurrent_two_storages)->ThreadRange(1, 32)->UseRealTime();
+
+static BucketStorage< size_t > *shared_locked = nullptr;
+static std::mutex shared_locked_mutex;
+
+static void BM_locked_insert_erase(benchmark::State &state)
+{
+	if (state.thread_index() == 0)
+		shared_locked = new BucketStorage< size_t >();
+	std::vector< BucketStorage< size_t >::iterator > local;
+	local.reserve(256);
+	for (auto _ : state)
+	{
+		for (size_t i = 0; i < 256; ++i)
+		{
+			std::lock_guard< std::mutex > lock(shared_locked_mutex);
+			local.push_back(shared_locked->insert(i));
+		}
+		for (const BucketStorage< size_t >::iterator &it : local)
+		{
+			std::lock_guard< std::mutex > lock(shared_locked_mutex);
+			shared_locked->erase(it);
+		}
+		local.clear();
+	}
+	if (state.thread_index() == 0)
+	{
+		delete shared_locked;
+		shared_locked = nullptr;
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations() * 512));
+}
+BENCHMARK(BM_locked_insert_erase)->ThreadRange(1, 32)->UseRealTime();
+
+static long resident_kb()
+{
+	std::ifstream statm("/proc/self/statm");
+	long pages = 0;
+	long resident = 0;
+	statm >> pages >> resident;
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+struct handoff_ring
+{
+	static constexpr size_t capacity = 4096;
+	std::array< ConcurrentBucketStorage< size_t >::handle, capacity > slots;
+	alignas(64) std::atomic< size_t > head{ 0 };
+	alignas(64) std::atomic< size_t > tail{ 0 };
+
+	void push(ConcurrentBucketStorage< size_t >::handle h)
+	{
+		const size_t position = tail.load(std::memory_order_relaxed);
+		while (position - head.load(std::memory_order_acquire) == capacity)
+			std::this_thread::yield();
+		slots[position % capacity] = h;
+		tail.store(position + 1, std::memory_order_release);
+	}
+
+	ConcurrentBucketStorage< size_t >::handle pop()
+	{
+		const size_t position = head.load(std::memory_order_relaxed);
+		while (tail.load(std::memory_order_acquire) == position)
+			std::this_thread::yield();
+		ConcurrentBucketStorage< size_t >::handle h = slots[position % capacity];
+		head.store(position + 1, std::memory_order_release);
+		return h;
+	}
+};
+
+static std::vector< std::unique_ptr< handoff_ring > > *shared_rings = nullptr;
+static std::vector< long > *rss_samples = nullptr;
+
+static void BM_concurrent_cross_thread_churn(benchmark::State &state)
+{
+	if (state.thread_index() == 0)
+	{
+		shared_concurrent = new ConcurrentBucketStorage< size_t >();
+		shared_rings = new std::vector< std::unique_ptr< handoff_ring > >();
+		for (int i = 0; i < state.threads() / 2; ++i)
+			shared_rings->push_back(std::make_unique< handoff_ring >());
+		rss_samples = new std::vector< long >{ resident_kb() };
+	}
+	const bool producer = state.thread_index() % 2 == 0;
+	const int64_t sample_every = static_cast< int64_t >(state.max_iterations / 4);
+	int64_t done = 0;
+	for (auto _ : state)
+	{
+		handoff_ring &ring = *(*shared_rings)[static_cast< size_t >(state.thread_index() / 2)];
+		if (producer)
+			ring.push(shared_concurrent->insert(static_cast< size_t >(done)));
+		else
+			shared_concurrent->erase(ring.pop());
+		if (state.thread_index() == 0 && ++done % sample_every == 0)
+			rss_samples->push_back(resident_kb());
+	}
+	if (state.thread_index() == 0)
+	{
+		for (size_t i = 0; i < rss_samples->size(); ++i)
+			state.counters["rss_kb_" + std::to_string(i)] = static_cast< double >((*rss_samples)[i]);
+		state.counters["capacity"] = static_cast< double >(shared_concurrent->capacity());
+		delete shared_concurrent;
+		delete shared_rings;
+		delete rss_samples;
+		shared_concurrent = nullptr;
+	}
+	state.SetItemsProcessed(static_cast< int64_t >(state.iterations()));
+}
+BENCHMARK(BM_concurrent_cross_thread_churn)->Threads(2)->Threads(4)->Threads(8)->Iterations(1 << 22)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,208 @@
+#ifndef LABA3_COLONY_BASELINE_H
+#define LABA3_COLONY_BASELINE_H
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+template< typename T, size_t BlockCapacity = 64 >
+class ColonyBaseline
+{
+	struct Block
+	{
+		alignas(T) unsigned char storage[sizeof(T) * BlockCapacity];
+		bool live[BlockCapacity] = {};
+		size_t used = 0;
+
+		T* slot(size_t i) { return std::launder(reinterpret_cast< T* >(storage) + i); }
+		const T* slot(size_t i) const { return std::launder(reinterpret_cast< const T* >(storage) + i); }
+	};
+
+	struct Position
+	{
+		size_t block;
+		size_t slot;
+	};
+
+  public:
+	using value_type = T;
+
+	template< typename Owner, typename Value >
+	class basic_iterator
+	{
+		friend class ColonyBaseline;
+
+	  public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = ptrdiff_t;
+		using pointer = Value*;
+		using reference = Value&;
+
+		basic_iterator() = default;
+		reference operator*() const { return *owner->blocks[block]->slot(slot); }
+		pointer operator->() const { return owner->blocks[block]->slot(slot); }
+		basic_iterator& operator++()
+		{
+			++slot;
+			skip();
+			return *this;
+		}
+		basic_iterator operator++(int)
+		{
+			basic_iterator previous = *this;
+			++*this;
+			return previous;
+		}
+		bool operator==(const basic_iterator& other) const { return block == other.block && slot == other.slot; }
+		bool operator!=(const basic_iterator& other) const { return !(*this == other); }
+
+	  private:
+		Owner* owner = nullptr;
+		size_t block = 0;
+		size_t slot = 0;
+
+		basic_iterator(Owner* owner, size_t block, size_t slot) : owner(owner), block(block), slot(slot) { skip(); }
+
+		void skip()
+		{
+			while (block < owner->blocks.size())
+			{
+				const Block& current = *owner->blocks[block];
+				while (slot < current.used && !current.live[slot])
+				{
+					++slot;
+				}
+				if (slot < current.used)
+				{
+					return;
+				}
+				++block;
+				slot = 0;
+			}
+		}
+	};
+
+	using iterator = basic_iterator< ColonyBaseline, T >;
+	using const_iterator = basic_iterator< const ColonyBaseline, const T >;
+
+	ColonyBaseline() = default;
+	ColonyBaseline(const ColonyBaseline& other) { *this = other; }
+	ColonyBaseline(ColonyBaseline&& other) noexcept :
+		blocks(std::move(other.blocks)), free_slots(std::move(other.free_slots)), count(other.count)
+	{
+		other.count = 0;
+	}
+	ColonyBaseline& operator=(const ColonyBaseline& other)
+	{
+		if (this != &other)
+		{
+			clear();
+			blocks.reserve(other.blocks.size());
+			for (const std::unique_ptr< Block >& source : other.blocks)
+			{
+				blocks.push_back(std::make_unique< Block >());
+				Block& copy = *blocks.back();
+				for (size_t i = 0; i < source->used; ++i)
+				{
+					if (source->live[i])
+					{
+						::new (static_cast< void* >(copy.slot(i))) T(*source->slot(i));
+						copy.live[i] = true;
+					}
+				}
+				copy.used = source->used;
+			}
+			free_slots = other.free_slots;
+			count = other.count;
+		}
+		return *this;
+	}
+	ColonyBaseline& operator=(ColonyBaseline&& other) noexcept
+	{
+		if (this != &other)
+		{
+			clear();
+			blocks = std::move(other.blocks);
+			free_slots = std::move(other.free_slots);
+			count = other.count;
+			other.count = 0;
+		}
+		return *this;
+	}
+	~ColonyBaseline() { clear(); }
+
+	size_t size() const noexcept { return count; }
+
+	iterator insert(const T& value)
+	{
+		Position position;
+		if (!free_slots.empty())
+		{
+			position = free_slots.back();
+		}
+		else
+		{
+			if (blocks.empty() || blocks.back()->used == BlockCapacity)
+			{
+				blocks.push_back(std::make_unique< Block >());
+			}
+			position = Position{ blocks.size() - 1, blocks.back()->used };
+		}
+		Block& target = *blocks[position.block];
+		::new (static_cast< void* >(target.slot(position.slot))) T(value);
+		target.live[position.slot] = true;
+		if (!free_slots.empty())
+		{
+			free_slots.pop_back();
+		}
+		else
+		{
+			++target.used;
+		}
+		++count;
+		return iterator(this, position.block, position.slot);
+	}
+
+	iterator erase(iterator it)
+	{
+		Block& target = *blocks[it.block];
+		target.slot(it.slot)->~T();
+		target.live[it.slot] = false;
+		free_slots.push_back(Position{ it.block, it.slot });
+		--count;
+		return ++it;
+	}
+
+	void clear() noexcept
+	{
+		for (const std::unique_ptr< Block >& current : blocks)
+		{
+			for (size_t i = 0; i < current->used; ++i)
+			{
+				if (current->live[i])
+				{
+					current->slot(i)->~T();
+				}
+			}
+		}
+		blocks.clear();
+		free_slots.clear();
+		count = 0;
+	}
+
+	iterator begin() { return iterator(this, 0, 0); }
+	iterator end() { return iterator(this, blocks.size(), 0); }
+	const_iterator begin() const { return const_iterator(this, 0, 0); }
+	const_iterator end() const { return const_iterator(this, blocks.size(), 0); }
+
+  private:
+	std::vector< std::unique_ptr< Block > > blocks;
+	std::vector< Position > free_slots;
+	size_t count = 0;
+};
+
+#endif	  // LABA3_COLONY_BASELINE_H
@@ -0,0 +1,504 @@
+#ifndef LABA3_CONCURRENT_BUCKET_STORAGE_HPP
+#define LABA3_CONCURRENT_BUCKET_STORAGE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template< typename T >
+class ConcurrentBucketStorage
+{
+	struct Slot
+	{
+		alignas(T) unsigned char storage[sizeof(T)];
+		uint32_t next_free = 0;
+		std::atomic< bool > live{ false };
+
+		T* value() noexcept { return std::launder(reinterpret_cast< T* >(storage)); }
+	};
+
+	enum class block_state : uint8_t
+	{
+		owned,
+		retired,
+		queued
+	};
+
+	struct Block
+	{
+		size_t capacity;
+		size_t bumped = 0;
+		uint32_t local_free = 0;
+		std::atomic< uint32_t > shared_free{ 0 };
+		std::atomic< size_t > live{ 0 };
+		std::atomic< block_state > state{ block_state::owned };
+		std::atomic< uint32_t > recycle_next{ 0 };
+		uint32_t id = 0;
+		Block* next = nullptr;
+		Slot* slots;
+
+		explicit Block(size_t capacity) : capacity(capacity), slots(new Slot[capacity]) {}
+		Block(const Block&) = delete;
+		Block& operator=(const Block&) = delete;
+		~Block() { delete[] slots; }
+	};
+
+	struct thread_entry
+	{
+		std::thread::id id;
+		Block* current = nullptr;
+	};
+
+	struct thread_cache_entry
+	{
+		uint64_t instance_id = 0;
+		Block** current = nullptr;
+	};
+
+	static constexpr size_t thread_cache_size = 4;
+
+	// Outlives the storage while exiting threads may still refer to it; owner is reset under the mutex on destruction.
+	struct thread_registry
+	{
+		std::mutex mutex;
+		ConcurrentBucketStorage* owner = nullptr;
+		std::vector< std::unique_ptr< thread_entry > > threads;
+	};
+
+	// One per thread; when the thread exits, its current block is handed back to every storage it inserted into.
+	struct thread_exit_hook
+	{
+		std::vector< std::pair< std::weak_ptr< thread_registry >, thread_entry* > > entries;
+
+		~thread_exit_hook()
+		{
+			for (const std::pair< std::weak_ptr< thread_registry >, thread_entry* >& registered : entries)
+			{
+				if (std::shared_ptr< thread_registry > registry = registered.first.lock())
+				{
+					std::lock_guard< std::mutex > lock(registry->mutex);
+					if (registry->owner)
+					{
+						registry->owner->release_thread(registered.second);
+					}
+				}
+			}
+		}
+	};
+
+  public:
+	using value_type = T;
+
+	class handle
+	{
+		friend class ConcurrentBucketStorage;
+
+	  public:
+		handle() = default;
+		T* get() const noexcept { return block ? block->slots[slot].value() : nullptr; }
+		T& operator*() const noexcept { return *get(); }
+		T* operator->() const noexcept { return get(); }
+		bool operator==(const handle& other) const noexcept { return block == other.block && slot == other.slot; }
+		bool operator!=(const handle& other) const noexcept { return !(*this == other); }
+
+	  private:
+		Block* block = nullptr;
+		uint32_t slot = 0;
+
+		handle(Block* block, uint32_t slot) : block(block), slot(slot) {}
+	};
+
+	explicit ConcurrentBucketStorage(size_t block_capacity = 64);
+	ConcurrentBucketStorage(const ConcurrentBucketStorage&) = delete;
+	ConcurrentBucketStorage& operator=(const ConcurrentBucketStorage&) = delete;
+	~ConcurrentBucketStorage();
+
+	template< typename... Args >
+	handle emplace(Args&&... args);
+	handle insert(const value_type& value);
+	handle insert(value_type&& value);
+	void erase(handle h) noexcept;
+
+	size_t size() const noexcept;
+	size_t capacity() const noexcept;
+	// for_each and clear must not run concurrently with insert or erase.
+	template< typename Function >
+	void for_each(Function&& function);
+	void clear() noexcept;
+
+  private:
+	size_t block_capacity;
+	uint64_t instance_id;
+	std::atomic< Block* > blocks{ nullptr };
+	std::atomic< size_t > block_count{ 0 };
+	static constexpr size_t table_segments = 32;
+	std::atomic< Block** > block_table[table_segments] = {};
+	std::atomic< uint32_t > next_block_id{ 1 };
+	std::atomic< uint64_t > recycle_head{ 0 };
+	std::shared_ptr< thread_registry > registry;
+
+	static uint64_t next_instance_id() noexcept
+	{
+		static std::atomic< uint64_t > counter{ 0 };
+		return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+
+	Block*& thread_block();
+	void release_thread(thread_entry* entry) noexcept;
+	Block* obtain_block();
+	void register_block(Block* fresh);
+	Block* lookup_block(uint32_t id) const noexcept;
+	void push_recycled(Block* partial) noexcept;
+	Block* pop_recycled() noexcept;
+	void retire(Block* old_block) noexcept;
+	void try_queue(Block* partial) noexcept;
+	static uint32_t acquire_slot(Block* owner) noexcept;
+	void destroy_blocks() noexcept;
+};
+
+template< typename T >
+ConcurrentBucketStorage< T >::ConcurrentBucketStorage(size_t block_capacity) :
+	block_capacity(block_capacity == 0 ? 1 : block_capacity), instance_id(next_instance_id()),
+	registry(std::make_shared< thread_registry >())
+{
+	registry->owner = this;
+}
+
+template< typename T >
+ConcurrentBucketStorage< T >::~ConcurrentBucketStorage()
+{
+	{
+		std::lock_guard< std::mutex > lock(registry->mutex);
+		registry->owner = nullptr;
+	}
+	destroy_blocks();
+	for (std::atomic< Block** >& segment : block_table)
+	{
+		delete[] segment.load();
+	}
+}
+
+template< typename T >
+typename ConcurrentBucketStorage< T >::Block*& ConcurrentBucketStorage< T >::thread_block()
+{
+	// The storages this thread looked up last, newest first. Instance ids are never reused, so
+	// the entry of a destroyed storage is never matched again and simply ages out.
+	thread_local thread_cache_entry cache[thread_cache_size] = {};
+	for (size_t i = 0; i < thread_cache_size; ++i)
+	{
+		if (cache[i].instance_id == instance_id)
+		{
+			return *cache[i].current;
+		}
+	}
+	thread_local thread_exit_hook exit_hook;
+	std::lock_guard< std::mutex > lock(registry->mutex);
+	const std::thread::id self = std::this_thread::get_id();
+	thread_entry* entry = nullptr;
+	for (const std::unique_ptr< thread_entry >& candidate : registry->threads)
+	{
+		if (candidate->id == self)
+		{
+			entry = candidate.get();
+		}
+	}
+	if (!entry)
+	{
+		using registration = std::pair< std::weak_ptr< thread_registry >, thread_entry* >;
+		std::erase_if(exit_hook.entries, [](const registration& registered) { return registered.first.expired(); });
+		exit_hook.entries.reserve(exit_hook.entries.size() + 1);
+		registry->threads.push_back(std::make_unique< thread_entry >());
+		entry = registry->threads.back().get();
+		entry->id = self;
+		exit_hook.entries.emplace_back(registry, entry);
+	}
+	std::rotate(cache, cache + thread_cache_size - 1, cache + thread_cache_size);
+	cache[0] = thread_cache_entry{ instance_id, &entry->current };
+	return entry->current;
+}
+
+template< typename T >
+void ConcurrentBucketStorage< T >::release_thread(thread_entry* entry) noexcept
+{
+	if (Block* current = entry->current)
+	{
+		// Slots the thread still held privately are only reachable by the next owner, so the block is queued now.
+		if (current->local_free != 0 || current->bumped < current->capacity)
+		{
+			current->state.store(block_state::queued);
+			push_recycled(current);
+		}
+		else
+		{
+			retire(current);
+		}
+	}
+	std::erase_if(registry->threads, [entry](const std::unique_ptr< thread_entry >& candidate) {
+		return candidate.get() == entry;
+	});
+}
+
+template< typename T >
+typename ConcurrentBucketStorage< T >::Block* ConcurrentBucketStorage< T >::obtain_block()
+{
+	if (Block* partial = pop_recycled())
+	{
+		partial->state.store(block_state::owned);
+		return partial;
+	}
+
+	Block* fresh = new Block(block_capacity);
+	try
+	{
+		register_block(fresh);
+	} catch (...)
+	{
+		delete fresh;
+		throw;
+	}
+	fresh->next = blocks.load(std::memory_order_relaxed);
+	while (!blocks.compare_exchange_weak(fresh->next, fresh, std::memory_order_release, std::memory_order_relaxed))
+	{
+	}
+	block_count.fetch_add(1, std::memory_order_relaxed);
+	return fresh;
+}
+
+template< typename T >
+void ConcurrentBucketStorage< T >::retire(Block* old_block) noexcept
+{
+	old_block->state.store(block_state::retired);
+	if (old_block->shared_free.load() != 0)
+	{
+		try_queue(old_block);
+	}
+}
+
+template< typename T >
+void ConcurrentBucketStorage< T >::try_queue(Block* partial) noexcept
+{
+	block_state expected = block_state::retired;
+	if (partial->state.compare_exchange_strong(expected, block_state::queued))
+	{
+		push_recycled(partial);
+	}
+}
+
+template< typename T >
+void ConcurrentBucketStorage< T >::register_block(Block* fresh)
+{
+	const uint32_t id = next_block_id.fetch_add(1, std::memory_order_relaxed);
+	const size_t segment = static_cast< size_t >(std::bit_width(id)) - 1;
+	Block** entries = block_table[segment].load(std::memory_order_acquire);
+	if (!entries)
+	{
+		Block** allocated = new Block*[size_t(1) << segment]();
+		if (block_table[segment].compare_exchange_strong(entries, allocated, std::memory_order_acq_rel))
+		{
+			entries = allocated;
+		}
+		else
+		{
+			delete[] allocated;
+		}
+	}
+	entries[id - (uint32_t(1) << segment)] = fresh;
+	fresh->id = id;
+}
+
+template< typename T >
+typename ConcurrentBucketStorage< T >::Block* ConcurrentBucketStorage< T >::lookup_block(uint32_t id) const noexcept
+{
+	const size_t segment = static_cast< size_t >(std::bit_width(id)) - 1;
+	return block_table[segment].load(std::memory_order_acquire)[id - (uint32_t(1) << segment)];
+}
+
+template< typename T >
+void ConcurrentBucketStorage< T >::push_recycled(Block* partial) noexcept
+{
+	uint64_t head = recycle_head.load(std::memory_order_relaxed);
+	uint64_t replacement;
+	do
+	{
+		partial->recycle_next.store(static_cast< uint32_t >(head), std::memory_order_relaxed);
+		replacement = (((head >> 32) + 1) << 32) | partial->id;
+	} while (
+		!recycle_head.compare_exchange_weak(head, replacement, std::memory_order_release, std::memory_order_relaxed));
+}
+
+template< typename T >
+typename ConcurrentBucketStorage< T >::Block* ConcurrentBucketStorage< T >::pop_recycled() noexcept
+{
+	uint64_t head = recycle_head.load(std::memory_order_acquire);
+	while (static_cast< uint32_t >(head) != 0)
+	{
+		Block* partial = lookup_block(static_cast< uint32_t >(head));
+		const uint64_t replacement = (((head >> 32) + 1) << 32) | partial->recycle_next.load(std::memory_order_relaxed);
+		if (recycle_head.compare_exchange_weak(head, replacement, std::memory_order_acquire, std::memory_order_acquire))
+		{
+			return partial;
+		}
+	}
+	return nullptr;
+}
+
+template< typename T >
+uint32_t ConcurrentBucketStorage< T >::acquire_slot(Block* owner) noexcept
+{
+	if (owner->local_free == 0 && owner->bumped < owner->capacity)
+	{
+		return static_cast< uint32_t >(owner->bumped++);
+	}
+	if (owner->local_free == 0)
+	{
+		owner->local_free = owner->shared_free.exchange(0, std::memory_order_acquire);
+	}
+	if (owner->local_free == 0)
+	{
+		return UINT32_MAX;
+	}
+	const uint32_t slot = owner->local_free - 1;
+	owner->local_free = owner->slots[slot].next_free;
+	return slot;
+}
+
+template< typename T >
+template< typename... Args >
+typename ConcurrentBucketStorage< T >::handle ConcurrentBucketStorage< T >::emplace(Args&&... args)
+{
+	Block*& current = thread_block();
+	uint32_t slot = current ? acquire_slot(current) : UINT32_MAX;
+	// A recycled block may arrive with its free slots already taken by its previous owner.
+	while (slot == UINT32_MAX)
+	{
+		Block* next = obtain_block();
+		if (current)
+		{
+			retire(current);
+		}
+		current = next;
+		slot = acquire_slot(current);
+	}
+
+	Slot& target = current->slots[slot];
+	try
+	{
+		::new (static_cast< void* >(target.storage)) T(std::forward< Args >(args)...);
+	} catch (...)
+	{
+		target.next_free = current->local_free;
+		current->local_free = slot + 1;
+		throw;
+	}
+	target.live.store(true, std::memory_order_release);
+	current->live.fetch_add(1, std::memory_order_relaxed);
+	return handle(current, slot);
+}
+
+template< typename T >
+typename ConcurrentBucketStorage< T >::handle ConcurrentBucketStorage< T >::insert(const value_type& value)
+{
+	return emplace(value);
+}
+
+template< typename T >
+typename ConcurrentBucketStorage< T >::handle ConcurrentBucketStorage< T >::insert(value_type&& value)
+{
+	return emplace(std::move(value));
+}
+
+template< typename T >
+void ConcurrentBucketStorage< T >::erase(handle h) noexcept
+{
+	Block* owner = h.block;
+	Slot& target = owner->slots[h.slot];
+	target.live.store(false, std::memory_order_relaxed);
+	target.value()->~T();
+
+	uint32_t head = owner->shared_free.load(std::memory_order_relaxed);
+	do
+	{
+		target.next_free = head;
+	} while (!owner->shared_free.compare_exchange_weak(head, h.slot + 1));
+	owner->live.fetch_sub(1, std::memory_order_relaxed);
+
+	if (owner->state.load() == block_state::retired)
+	{
+		try_queue(owner);
+	}
+}
+
+template< typename T >
+size_t ConcurrentBucketStorage< T >::size() const noexcept
+{
+	size_t total = 0;
+	for (const Block* current = blocks.load(std::memory_order_acquire); current; current = current->next)
+	{
+		total += current->live.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+template< typename T >
+size_t ConcurrentBucketStorage< T >::capacity() const noexcept
+{
+	return block_count.load(std::memory_order_relaxed) * block_capacity;
+}
+
+template< typename T >
+template< typename Function >
+void ConcurrentBucketStorage< T >::for_each(Function&& function)
+{
+	for (Block* current = blocks.load(std::memory_order_acquire); current; current = current->next)
+	{
+		for (size_t i = 0; i < current->capacity; ++i)
+		{
+			if (current->slots[i].live.load(std::memory_order_acquire))
+			{
+				function(*current->slots[i].value());
+			}
+		}
+	}
+}
+
+template< typename T >
+void ConcurrentBucketStorage< T >::clear() noexcept
+{
+	std::lock_guard< std::mutex > lock(registry->mutex);
+	destroy_blocks();
+	for (const std::unique_ptr< thread_entry >& entry : registry->threads)
+	{
+		entry->current = nullptr;
+	}
+}
+
+template< typename T >
+void ConcurrentBucketStorage< T >::destroy_blocks() noexcept
+{
+	Block* current = blocks.exchange(nullptr);
+	while (current)
+	{
+		Block* next = current->next;
+		for (size_t i = 0; i < current->capacity; ++i)
+		{
+			if (current->slots[i].live.load(std::memory_order_relaxed))
+			{
+				current->slots[i].value()->~T();
+			}
+		}
+		delete current;
+		current = next;
+	}
+	block_count.store(0);
+	next_block_id.store(1);
+	recycle_head.store(0);
+}
+
+#endif	  // LABA3_CONCURRENT_BUCKET_STORAGE_HPP
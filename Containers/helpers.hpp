@@ -3,9 +3,55 @@
 
 #include "bucket_storage.hpp"
 
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <memory_resource>
+#include <new>
 #include <ostream>
 #include <string>
 
+std::atomic< size_t > allocationCount{ 0 };
+
+// The replacements are kept out of line. Inlined, GCC pairs the malloc() inside operator new with the delete
+// expression (or operator new with the free() inside operator delete) and reports -Wmismatched-new-delete.
+[[gnu::noinline]] void *operator new(size_t size)
+{
+	++allocationCount;
+	if (void *memory = std::malloc(size ? size : 1))
+		return memory;
+	throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void *operator new(size_t size, std::align_val_t alignment)
+{
+	++allocationCount;
+	const size_t align = static_cast< size_t >(alignment);
+	if (void *memory = std::aligned_alloc(align, (size + align - 1) / align * align))
+		return memory;
+	throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void *memory) noexcept
+{
+	std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void *memory, size_t) noexcept
+{
+	std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void *memory, std::align_val_t) noexcept
+{
+	std::free(memory);
+}
+
+[[gnu::noinline]] void operator delete(void *memory, size_t, std::align_val_t) noexcept
+{
+	std::free(memory);
+}
+
 class NoCopy
 {
   public:
@@ -55,6 +101,64 @@ class OpCount
 	}
 };
 
+template< typename T >
+class CountingAllocator
+{
+  public:
+	using value_type = T;
+
+	static inline size_t allocations = 0;
+	static inline size_t liveAllocations = 0;
+
+	CountingAllocator() = default;
+	template< typename U >
+	CountingAllocator(const CountingAllocator< U > &) noexcept
+	{
+	}
+
+	T *allocate(size_t n)
+	{
+		++CountingAllocator< char >::allocations;
+		++CountingAllocator< char >::liveAllocations;
+		return std::allocator< T >().allocate(n);
+	}
+	void deallocate(T *p, size_t n) noexcept
+	{
+		--CountingAllocator< char >::liveAllocations;
+		std::allocator< T >().deallocate(p, n);
+	}
+
+	template< typename U >
+	bool operator==(const CountingAllocator< U > &) const noexcept
+	{
+		return true;
+	}
+	template< typename U >
+	bool operator!=(const CountingAllocator< U > &) const noexcept
+	{
+		return false;
+	}
+};
+
+class CountingResource : public std::pmr::memory_resource
+{
+  public:
+	size_t allocations = 0;
+
+	explicit CountingResource(std::pmr::memory_resource *upstream) noexcept : upstream(upstream) {}
+
+  private:
+	std::pmr::memory_resource *upstream;
+
+	void *do_allocate(size_t bytes, size_t alignment) override
+	{
+		++allocations;
+		return upstream->allocate(bytes, alignment);
+	}
+	void do_deallocate(void *p, size_t bytes, size_t alignment) override { upstream->deallocate(p, bytes, alignment); }
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
 OpCount opCount;
 const OpCount NO_OP = OpCount(0, 0, 0, 0, 0, 0);
 
@@ -79,10 +183,11 @@ class CountedOperationObject
 	bool operator==(const CountedOperationObject &rhs) const { return number == rhs.number; }
 };
 
-BucketStorage< CountedOperationObject > prepare()
+template< typename Storage = BucketStorage< CountedOperationObject > >
+Storage prepare()
 {
 	size_t n = 1000;
-	auto b = BucketStorage< CountedOperationObject >();
+	auto b = Storage();
 	for (size_t i = 0; i < n; ++i)
 	{
 		b.insert(CountedOperationObject(i));
@@ -103,5 +208,7 @@ using bs_sizet_t = BucketStorage< size_t >;
 using bs_string_t = BucketStorage< std::string >;
 using bs_nc_t = BucketStorage< NoCopy >;
 using bs_co_t = BucketStorage< CountedOperationObject >;
+using bs_counting_t = BucketStorage< size_t, CountingAllocator< size_t > >;
+using bs_pmr_t = pmr::BucketStorage< size_t >;
 
 #endif /* HELPERS_HPP */
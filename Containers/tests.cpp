@@ -1,13 +1,28 @@
 #include "bucket_storage.hpp"
+#include "concurrent_bucket_storage.hpp"
 #include "helpers.hpp"
 #include <type_traits>
 
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <thread>
 #include <utility>
+#include <vector>
 
 TEST(traits, default_constructor)
 {
@@ -137,8 +152,96 @@ TEST(traits, methods)
 		std::is_invocable_r_v< bs_sizet_t::iterator, decltype(METHOD(get_to_distance)), bs_sizet_t &, bs_sizet_t::iterator, const bs_sizet_t::difference_type >);
 }
 
-TEST(base, ctor)
+struct std_allocators
 {
+	template< typename T, size_t BlockCapacity = 0 >
+	using storage = BucketStorage< T, std::allocator< T >, BlockCapacity >;
+};
+
+struct counting_allocators
+{
+	template< typename T, size_t BlockCapacity = 0 >
+	using storage = BucketStorage< T, CountingAllocator< T >, BlockCapacity >;
+};
+
+struct pmr_allocators
+{
+	template< typename T, size_t BlockCapacity = 0 >
+	using storage = BucketStorage< T, std::pmr::polymorphic_allocator< T >, BlockCapacity >;
+};
+
+// The storages in a test are built with default-constructed allocators, so for pmr_allocators the arena is installed
+// as the default resource for the duration of the test.
+template< typename Allocators >
+class allocator_test : public ::testing::Test
+{
+  protected:
+	using bs_sizet_t = typename Allocators::template storage< size_t >;
+	using bs_string_t = typename Allocators::template storage< std::string >;
+	using bs_nc_t = typename Allocators::template storage< NoCopy >;
+	using bs_co_t = typename Allocators::template storage< CountedOperationObject >;
+	using bs_fixed_t = typename Allocators::template storage< size_t, 16 >;
+
+	static constexpr size_t arena_size = 1 << 24;
+	std::unique_ptr< std::byte[] > buffer;
+	std::optional< std::pmr::monotonic_buffer_resource > arena;
+	std::optional< CountingResource > counted;
+	std::pmr::memory_resource *previous = nullptr;
+
+	void SetUp() override
+	{
+		opCount.clearCounters();
+		if constexpr (std::is_same_v< Allocators, pmr_allocators >)
+		{
+			buffer.reset(new std::byte[arena_size]);
+			arena.emplace(buffer.get(), arena_size, std::pmr::null_memory_resource());
+			counted.emplace(&*arena);
+			previous = std::pmr::set_default_resource(&*counted);
+		}
+	}
+
+	void TearDown() override
+	{
+		if constexpr (std::is_same_v< Allocators, pmr_allocators >)
+			std::pmr::set_default_resource(previous);
+		ASSERT_EQ(CountingAllocator< char >::liveAllocations, 0);
+	}
+
+	size_t allocations() const
+	{
+		if constexpr (std::is_same_v< Allocators, counting_allocators >)
+			return CountingAllocator< char >::allocations;
+		else if constexpr (std::is_same_v< Allocators, pmr_allocators >)
+			return counted->allocations;
+		else
+			return allocationCount;
+	}
+};
+
+using allocator_families = ::testing::Types< std_allocators, counting_allocators, pmr_allocators >;
+
+template< typename Allocators >
+class base : public allocator_test< Allocators >
+{
+};
+TYPED_TEST_SUITE(base, allocator_families);
+
+template< typename Allocators >
+class coperators : public allocator_test< Allocators >
+{
+};
+TYPED_TEST_SUITE(coperators, allocator_families);
+
+template< typename Allocators >
+class iterators : public allocator_test< Allocators >
+{
+};
+TYPED_TEST_SUITE(iterators, allocator_families);
+
+TYPED_TEST(base, ctor)
+{
+	using bs_nc_t = typename TestFixture::bs_nc_t;
+
 	bs_nc_t b = bs_nc_t(2);
 	ASSERT_TRUE(b.empty());
 	ASSERT_EQ(b.size(), 0);
@@ -171,7 +274,7 @@ TEST(base, ctor)
 	ASSERT_EQ(b.size(), 3);
 
 	int v[3] = {};
-	for (bs_nc_t::iterator it = b.begin(); it != b.end(); ++it)
+	for (typename bs_nc_t::iterator it = b.begin(); it != b.end(); ++it)
 		if (it->m_value <= 2 && it->m_value >= 0)
 			v[it->m_value]++;
 
@@ -180,8 +283,10 @@ TEST(base, ctor)
 	EXPECT_EQ(v[2], 1);
 }
 
-TEST(base, empty)
+TYPED_TEST(base, empty)
 {
+	using bs_co_t = typename TestFixture::bs_co_t;
+
 	bs_co_t b = bs_co_t();
 	EXPECT_TRUE(b.empty());
 	ASSERT_EQ(b.size(), 0);
@@ -198,8 +303,10 @@ TEST(base, empty)
 	ASSERT_EQ(opCount.creationCount, 1);
 }
 
-TEST(base, insert)
+TYPED_TEST(base, insert)
 {
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
 	constexpr size_t n = 1000;
 	bs_sizet_t b = bs_sizet_t();
 
@@ -219,14 +326,14 @@ TEST(base, insert)
 
 	for (size_t i = 0; i < n; ++i)
 	{
-		bs_sizet_t::iterator it = std::find(b.begin(), b.end(), i);
+		typename bs_sizet_t::iterator it = std::find(b.begin(), b.end(), i);
 		ASSERT_TRUE(*it == i);
 	}
 
 	size_t v[n] = {};
 	for (size_t i = 0; i < n; ++i)
 	{
-		bs_sizet_t::iterator e = b.get_to_distance(b.begin(), i);
+		typename bs_sizet_t::iterator e = b.get_to_distance(b.begin(), i);
 		ASSERT_TRUE(*e < n);
 		v[*e]++;
 	}
@@ -236,7 +343,7 @@ TEST(base, insert)
 
 	for (size_t i = 0; i < n; ++i)
 	{
-		bs_sizet_t::iterator e = b.get_to_distance(b.end(), -1 - i);
+		typename bs_sizet_t::iterator e = b.get_to_distance(b.end(), -1 - i);
 		ASSERT_TRUE(*e < n);
 		v[*e]++;
 	}
@@ -244,7 +351,7 @@ TEST(base, insert)
 	for (size_t i = 0; i < n; ++i)
 		ASSERT_EQ(v[i], 2);
 
-	bs_sizet_t::iterator it = b.end()--;
+	typename bs_sizet_t::iterator it = b.end()--;
 	do
 	{
 		--it;
@@ -256,9 +363,76 @@ TEST(base, insert)
 		ASSERT_EQ(v[i], 3);
 }
 
-TEST(base, erase)
+TYPED_TEST(base, emplace)
+{
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = bs_co_t();
+	opCount.clearCounters();
+	for (size_t i = 0; i < 100; ++i)
+	{
+		typename bs_co_t::iterator it = b.emplace(i);
+		ASSERT_EQ(it->number, i);
+	}
+	ASSERT_EQ(b.size(), 100);
+	ASSERT_EQ(opCount, OpCount(100, 0, 0, 0, 0, 0));
+}
+
+TYPED_TEST(base, insert_range)
 {
-	bs_co_t b = prepare();
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	std::vector< size_t > values(1000);
+	std::iota(values.begin(), values.end(), 0);
+
+	bs_sizet_t b = bs_sizet_t();
+	b.insert(values.end()[-1]);
+	typename bs_sizet_t::iterator first = b.insert(values.begin(), values.end() - 1);
+	ASSERT_EQ(b.size(), values.size());
+	ASSERT_EQ(b.capacity(), (values.size() + 63) & -64);
+	ASSERT_EQ(*first, 0);
+
+	std::vector< size_t > stored(b.begin(), b.end());
+	std::sort(stored.begin(), stored.end());
+	ASSERT_EQ(stored, values);
+	ASSERT_EQ(b.get_to_distance(b.begin(), values.size()), b.end());
+
+	b.insert_n(30, 7);
+	ASSERT_EQ(b.size(), values.size() + 30);
+	ASSERT_EQ(std::count(b.begin(), b.end(), 7), 31);
+	ASSERT_EQ(b.insert(values.begin(), values.begin()), b.end());
+}
+
+TYPED_TEST(base, insert_range_throwing)
+{
+	using bs_nc_t = typename TestFixture::bs_nc_t;
+
+	bs_nc_t b = bs_nc_t(4);
+	std::vector< NoCopy > values;
+	for (int i = 0; i < 10; ++i)
+		values.emplace_back(i);
+
+	bool throw_detected = false;
+	try
+	{
+		b.insert(values.begin(), values.end());
+	} catch (int)
+	{
+		throw_detected = true;
+	}
+	ASSERT_TRUE(throw_detected);
+	ASSERT_EQ(b.size(), 0);
+	ASSERT_EQ(b.begin(), b.end());
+
+	b.insert(std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
+	ASSERT_EQ(b.size(), values.size());
+}
+
+TYPED_TEST(base, erase)
+{
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
 	size_t n = b.size();
 	for (size_t i = 0; i < n; ++i)
 	{
@@ -271,8 +445,87 @@ TEST(base, erase)
 	ASSERT_EQ(opCount.dtorCount, n);
 }
 
-TEST(base, shrink_to_fit)
+TYPED_TEST(base, erase_range)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(16);
+	for (size_t i = 0; i < 200; ++i)
+		b.insert(i);
+
+	typename bs_sizet_t::iterator first = std::next(b.begin(), 10);
+	typename bs_sizet_t::iterator last = std::next(b.begin(), 150);
+	typename bs_sizet_t::iterator it = b.erase(first, last);
+	ASSERT_EQ(*it, 150);
+	ASSERT_EQ(b.size(), 60);
+	ASSERT_EQ(b.capacity(), 5 * 16);
+
+	std::vector< size_t > expected(10);
+	std::iota(expected.begin(), expected.end(), size_t(0));
+	for (size_t i = 150; i < 200; ++i)
+		expected.push_back(i);
+	ASSERT_TRUE(std::equal(expected.begin(), expected.end(), b.begin(), b.end()));
+	for (ptrdiff_t d = 0; d <= 60; ++d)
+		ASSERT_EQ(b.get_to_distance(b.begin(), d), std::next(b.begin(), d));
+
+	ASSERT_EQ(b.erase(b.begin(), b.begin()), b.begin());
+	ASSERT_EQ(b.erase(b.begin(), b.end()), b.end());
+	ASSERT_TRUE(b.empty());
+	ASSERT_EQ(b.capacity(), 0);
+	b.insert(7);
+	ASSERT_EQ(*b.begin(), 7);
+}
+
+TYPED_TEST(base, erase_if)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(16);
+	for (size_t i = 0; i < 1000; ++i)
+		b.insert(i);
+
+	ASSERT_EQ(erase_if(b, [](size_t value) { return value % 5 < 2 || (value >= 300 && value < 400); }), 460);
+	ASSERT_EQ(b.size(), 540);
+	std::vector< size_t > expected;
+	for (size_t i = 0; i < 1000; ++i)
+		if (!(i % 5 < 2 || (i >= 300 && i < 400)))
+			expected.push_back(i);
+	ASSERT_TRUE(std::equal(expected.begin(), expected.end(), b.begin(), b.end()));
+	ASSERT_EQ(std::distance(b.get_to_distance(b.end(), -540), b.end()), 540);
+
+	for (size_t i = 0; i < 100; ++i)
+		b.insert(5000 + i);
+	ASSERT_EQ(b.size(), 640);
+	ASSERT_EQ(erase_if(b, [](size_t) { return true; }), 640);
+	ASSERT_TRUE(b.empty());
+	ASSERT_EQ(b.capacity(), 0);
+}
+
+TYPED_TEST(base, erase_if_throwing)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(8);
+	for (size_t i = 0; i < 100; ++i)
+		b.insert(i);
+	ASSERT_THROW(erase_if(b,
+						  [](size_t value)
+						  {
+							  if (value == 50)
+								  throw std::runtime_error("stop");
+							  return value % 2 == 0;
+						  }),
+				 std::runtime_error);
+	ASSERT_EQ(b.size(), 75);
+	ASSERT_EQ(std::distance(b.begin(), b.end()), 75);
+	ASSERT_EQ(std::count_if(b.begin(), b.end(), [](size_t value) { return value < 50 && value % 2 == 0; }), 0);
+	ASSERT_EQ(*std::prev(b.end()), 99);
+}
+
+TYPED_TEST(base, shrink_to_fit)
 {
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
 	bs_sizet_t b = bs_sizet_t();
 
 	size_t n_insert = 192;
@@ -285,14 +538,14 @@ TEST(base, shrink_to_fit)
 
 	for (size_t i = 0; i < n_erase; ++i)
 	{
-		bs_sizet_t::iterator it = std::find(b.begin(), b.end(), i);
+		typename bs_sizet_t::iterator it = std::find(b.begin(), b.end(), i);
 		b.erase(it);
 	}
 	ASSERT_EQ(b.capacity(), n_insert - 64);
 
 	for (size_t i = n_end_erase; i < n_insert; ++i)
 	{
-		bs_sizet_t::iterator it = std::find(b.begin(), b.end(), i);
+		typename bs_sizet_t::iterator it = std::find(b.begin(), b.end(), i);
 		b.erase(it);
 	}
 	ASSERT_EQ(b.capacity(), n_insert - 64);
@@ -303,14 +556,273 @@ TEST(base, shrink_to_fit)
 
 	for (size_t i = n_erase; i < n_end_erase; ++i)
 	{
-		bs_sizet_t::iterator it = std::find(b.begin(), b.end(), i);
+		typename bs_sizet_t::iterator it = std::find(b.begin(), b.end(), i);
 		ASSERT_EQ(*it, i);
 	}
 }
 
-TEST(base, clear)
+TYPED_TEST(base, shrink_to_fit_throwing_move)
 {
-	bs_co_t b = prepare();
+	struct ThrowingMove
+	{
+		size_t value;
+		explicit ThrowingMove(size_t value) : value(value) {}
+		ThrowingMove(const ThrowingMove &) = default;
+		ThrowingMove(ThrowingMove &&other) noexcept(false) : value(other.value) {}
+	};
+	typename TypeParam::template storage< ThrowingMove > b(4);
+	for (size_t i = 0; i < 20; ++i)
+		b.insert(ThrowingMove(i));
+	erase_if(b, [](const ThrowingMove &element) { return element.value < 8 || element.value % 4 != 0; });
+	const ThrowingMove *kept = &*b.begin();
+	static_assert(noexcept(b.shrink_to_fit()));
+	b.shrink_to_fit();
+	ASSERT_EQ(b.size(), 3);
+	ASSERT_EQ(b.capacity(), 12);
+	ASSERT_EQ(&*b.begin(), kept);
+	ASSERT_EQ(b.begin()->value, 8);
+}
+
+TYPED_TEST(base, fixed_block_capacity)
+{
+	using bs_fixed_t = typename TestFixture::bs_fixed_t;
+
+	bs_fixed_t b;
+	for (size_t i = 0; i < 100; ++i)
+		b.insert(i);
+	ASSERT_EQ(b.capacity(), 112);
+
+	for (size_t i = 0; i < 60; ++i)
+		b.erase(std::find(b.begin(), b.end(), i));
+	b.shrink_to_fit();
+	ASSERT_EQ(b.size(), 40);
+	ASSERT_EQ(b.capacity(), 48);
+	ASSERT_EQ(std::accumulate(b.begin(), b.end(), size_t(0)), (60 + 99) * 40 / 2);
+
+	bs_fixed_t c = std::move(b);
+	ASSERT_THROW((bs_fixed_t(1000)), std::invalid_argument);
+	bs_fixed_t d(16);
+	d.insert(1);
+	ASSERT_EQ(d.capacity(), 16);
+	c.swap(d);
+	ASSERT_EQ(d.size(), 40);
+	ASSERT_EQ(erase_if(d, [](size_t value) { return value % 2 == 0; }), 20);
+}
+
+TYPED_TEST(base, block_growth)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+	using bs_fixed_t = typename TestFixture::bs_fixed_t;
+
+	bs_sizet_t b = bs_sizet_t(16);
+	ASSERT_EQ(b.max_block_capacity(), 16);
+	b.set_max_block_capacity(8);
+	ASSERT_EQ(b.max_block_capacity(), 16);
+	b.set_max_block_capacity(256);
+	ASSERT_EQ(b.max_block_capacity(), 256);
+
+	std::vector< size_t > capacities;
+	for (size_t i = 0; i < 1000; ++i)
+	{
+		b.insert(i);
+		if (capacities.empty() || capacities.back() != b.capacity())
+			capacities.push_back(b.capacity());
+	}
+	ASSERT_EQ(capacities, (std::vector< size_t >{ 16, 32, 64, 128, 256, 512, 768, 1024 }));
+
+	erase_if(b, [](size_t value) { return value % 4 != 0; });
+	b.shrink_to_fit();
+	ASSERT_EQ(b.size(), 250);
+	ASSERT_EQ(b.capacity(), 256);
+	ASSERT_EQ(std::accumulate(b.begin(), b.end(), size_t(0)), 996 * 250 / 2);
+
+	bs_sizet_t c = b;
+	ASSERT_EQ(c.max_block_capacity(), 256);
+	c.clear();
+	c.shrink_to_fit();
+	c.reserve(600);
+	ASSERT_EQ(c.capacity(), 768);
+
+	bs_fixed_t d;
+	d.set_max_block_capacity(256);
+	ASSERT_EQ(d.max_block_capacity(), 16);
+}
+
+TYPED_TEST(base, defragment)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(16);
+	for (size_t i = 0; i < 1000; ++i)
+		b.insert(i);
+	erase_if(b, [](size_t value) { return value % 10 != 0; });
+	ASSERT_EQ(b.size(), 100);
+	ASSERT_EQ(b.capacity(), 992);
+
+	std::vector< typename bs_sizet_t::handle > handles(1000);
+	for (typename bs_sizet_t::iterator it = b.begin(); it != b.end(); ++it)
+		handles[*it] = b.get_handle(it);
+
+	size_t relocations = 0;
+	size_t slices = 0;
+	for (size_t moved; (moved = b.defragment(7, [&](typename bs_sizet_t::const_iterator from, typename bs_sizet_t::iterator to) {
+							ASSERT_EQ(b.get_handle(from), handles[*from]);
+							handles[*to] = b.get_handle(to);
+							++relocations;
+						})) != 0;)
+	{
+		ASSERT_LE(moved, 7);
+		++slices;
+	}
+	ASSERT_GT(slices, 1);
+	ASSERT_EQ(b.size(), 100);
+	ASSERT_EQ(b.capacity(), 112);
+	ASSERT_LE(relocations, 100);
+
+	size_t count = 0;
+	for (size_t value : b)
+	{
+		ASSERT_EQ(value % 10, 0);
+		ASSERT_EQ(*b.get(handles[value]), value);
+		++count;
+	}
+	ASSERT_EQ(count, 100);
+	ASSERT_EQ(std::distance(b.begin(), b.end()), 100);
+	ASSERT_EQ(b.defragment(100, [](typename bs_sizet_t::const_iterator, typename bs_sizet_t::iterator) {}), 0);
+}
+
+TYPED_TEST(base, defragment_resumes)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(16);
+	for (size_t i = 0; i < 1000; ++i)
+		b.insert(i);
+	erase_if(b, [](size_t value) { return value % 10 != 0; });
+	auto ignore = [](typename bs_sizet_t::const_iterator, typename bs_sizet_t::iterator) {};
+
+	ASSERT_EQ(b.defragment(5, ignore), 5);
+	std::optional< typename bs_sizet_t::snapshot_type > view = b.snapshot();
+	ASSERT_EQ(b.defragment(5, ignore), 0);
+	ASSERT_EQ(std::accumulate(view->begin(), view->end(), size_t(0)), 990 * 100 / 2);
+	view.reset();
+	ASSERT_EQ(b.defragment(5, ignore), 5);
+	b.erase(std::find(b.begin(), b.end(), 0));
+	b.erase(std::find(b.begin(), b.end(), 500));
+	ASSERT_EQ(b.defragment(5, ignore), 5);
+	b.insert(1000);
+	while (b.defragment(5, ignore) != 0)
+	{
+	}
+	ASSERT_EQ(b.size(), 99);
+	ASSERT_EQ(b.capacity(), 112);
+	ASSERT_EQ(std::distance(b.begin(), b.end()), 99);
+	ASSERT_EQ(std::accumulate(b.begin(), b.end(), size_t(0)), 990 * 100 / 2 - 500 + 1000);
+
+	for (size_t i = 0; i < 13; ++i)
+		b.insert(2000 + i);
+	ASSERT_EQ(b.capacity(), 112);
+	b.insert(3000);
+	ASSERT_EQ(b.size(), 113);
+	ASSERT_EQ(std::distance(b.begin(), b.end()), 113);
+}
+
+TYPED_TEST(base, defragment_after_splice)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(16);
+	bs_sizet_t c = bs_sizet_t(16);
+	for (size_t i = 0; i < 1000; ++i)
+		b.insert(i);
+	for (size_t i = 0; i < 500; ++i)
+		c.insert(1000 + i);
+	erase_if(b, [](size_t value) { return value % 10 != 0; });
+	erase_if(c, [](size_t value) { return value % 10 != 0; });
+	auto ignore = [](typename bs_sizet_t::const_iterator, typename bs_sizet_t::iterator) {};
+
+	ASSERT_EQ(b.defragment(5, ignore), 5);
+	ASSERT_EQ(c.defragment(5, ignore), 5);
+	b.splice(std::move(c));
+	ASSERT_EQ(c.defragment(5, ignore), 0);
+	while (b.defragment(5, ignore) != 0)
+	{
+	}
+	ASSERT_EQ(b.size(), 150);
+	ASSERT_EQ(b.capacity(), 160);
+	ASSERT_EQ(std::distance(b.begin(), b.end()), 150);
+	ASSERT_EQ(std::accumulate(b.begin(), b.end(), size_t(0)), 1490 * 150 / 2);
+}
+
+TYPED_TEST(base, reserve)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t();
+	b.reserve(1000);
+	ASSERT_EQ(b.capacity(), 1024);
+	ASSERT_TRUE(b.empty());
+
+	size_t before = this->allocations();
+	for (size_t i = 0; i < 1000; ++i)
+		b.insert(i);
+	ASSERT_EQ(this->allocations(), before);
+	ASSERT_EQ(b.capacity(), 1024);
+
+	while (!b.empty())
+		b.erase(b.begin());
+	ASSERT_EQ(b.capacity(), 1024);
+
+	b.shrink_to_fit();
+	ASSERT_EQ(b.capacity(), 0);
+}
+
+TYPED_TEST(base, zero_block_capacity)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(0);
+	b.reserve(3);
+	ASSERT_GE(b.capacity(), 3);
+	for (size_t i = 0; i < 10; ++i)
+		b.insert(i);
+	ASSERT_EQ(b.size(), 10);
+	ASSERT_EQ(std::accumulate(b.begin(), b.end(), size_t(0)), 45);
+}
+
+TYPED_TEST(base, retained_blocks)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t();
+	b.set_retained_blocks(4);
+	ASSERT_EQ(b.retained_blocks(), 4);
+
+	for (size_t i = 0; i < 640; ++i)
+		b.insert(i);
+	b.clear();
+	ASSERT_EQ(b.capacity(), 256);
+
+	size_t before = this->allocations();
+	for (size_t round = 0; round < 3; ++round)
+	{
+		for (size_t i = 0; i < 256; ++i)
+			b.insert(i);
+		while (!b.empty())
+			b.erase(b.begin());
+	}
+	ASSERT_EQ(this->allocations(), before);
+	ASSERT_EQ(b.capacity(), 256);
+
+	b.set_retained_blocks(0);
+	ASSERT_EQ(b.capacity(), 0);
+}
+
+TYPED_TEST(base, clear)
+{
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
 	size_t n = b.size();
 	b.clear();
 
@@ -320,9 +832,182 @@ TEST(base, clear)
 	ASSERT_EQ(b.begin(), b.end());
 }
 
-TEST(base, iterating)
+TYPED_TEST(base, erase_reuses_slot)
+{
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
+	size_t n = b.size();
+	size_t capacity = b.capacity();
+
+	typename bs_co_t::iterator it = b.begin();
+	CountedOperationObject *slot = &*it;
+	b.erase(it);
+	typename bs_co_t::iterator inserted = b.insert(CountedOperationObject(n));
+
+	ASSERT_EQ(&*inserted, slot);
+	ASSERT_EQ(b.size(), n);
+	ASSERT_EQ(b.capacity(), capacity);
+	ASSERT_EQ(opCount, OpCount(1, 0, 1, 0, 0, 2));
+}
+
+TYPED_TEST(base, handles)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	static_assert(std::is_same_v< decltype(bs_sizet_t::handle::generation), uint64_t >);
+	bs_sizet_t b = bs_sizet_t(4);
+	std::vector< typename bs_sizet_t::handle > handles;
+	for (size_t i = 0; i < 16; ++i)
+		handles.push_back(b.get_handle(b.insert(i)));
+
+	for (size_t i = 0; i < 16; ++i)
+		ASSERT_EQ(*b.get(handles[i]), i);
+	ASSERT_EQ(b.get(b.get_handle(b.end())), nullptr);
+	ASSERT_EQ(b.get(typename bs_sizet_t::handle()), nullptr);
+
+	typename bs_sizet_t::iterator it = b.begin();
+	std::advance(it, 5);
+	typename bs_sizet_t::handle erased = b.get_handle(it);
+	b.erase(it);
+	ASSERT_EQ(b.get(erased), nullptr);
+	typename bs_sizet_t::handle reused = b.get_handle(b.insert(100));
+	ASSERT_EQ(reused.block, erased.block);
+	ASSERT_EQ(reused.slot, erased.slot);
+	ASSERT_EQ(b.get(erased), nullptr);
+	ASSERT_EQ(*b.get(reused), 100);
+
+	for (size_t i = 0; i < 4; ++i)
+		b.erase(b.begin());
+	for (size_t i = 0; i < 4; ++i)
+		ASSERT_EQ(b.get(handles[i]), nullptr);
+	for (size_t i = 0; i < 4; ++i)
+		b.insert(200 + i);
+	for (size_t i = 0; i < 4; ++i)
+		ASSERT_EQ(b.get(handles[i]), nullptr);
+	ASSERT_EQ(*b.get(handles[15]), 15);
+
+	bs_sizet_t moved = std::move(b);
+	ASSERT_EQ(*moved.get(handles[15]), 15);
+	ASSERT_EQ(*moved.get(reused), 100);
+
+	moved.clear();
+	ASSERT_EQ(moved.get(handles[15]), nullptr);
+	moved.insert(15);
+	ASSERT_EQ(moved.get(handles[15]), nullptr);
+	ASSERT_EQ(moved.get(reused), nullptr);
+}
+
+#if LABA3_BUCKET_STORAGE_STATS
+TYPED_TEST(base, stats)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(10);
+	bucket_storage_stats empty = b.stats();
+	ASSERT_EQ(empty.live_elements, 0);
+	ASSERT_EQ(empty.allocated_blocks, 0);
+	ASSERT_EQ(empty.element_bytes, 0);
+
+	for (size_t i = 0; i < 35; ++i)
+		b.insert(i);
+	bucket_storage_stats full = b.stats();
+	ASSERT_EQ(full.live_elements, 35);
+	ASSERT_EQ(full.allocated_blocks, 4);
+	ASSERT_EQ(full.slot_capacity, b.capacity());
+	ASSERT_EQ(full.occupancy_histogram[10], 3);
+	ASSERT_EQ(full.occupancy_histogram[5], 1);
+	ASSERT_EQ(full.element_bytes, 40 * sizeof(size_t));
+	ASSERT_GT(full.metadata_bytes, 0);
+	ASSERT_EQ(full.blocks_allocated_total, 4);
+
+	b.set_retained_blocks(1);
+	erase_if(b, [](size_t value) { return value < 20; });
+	bucket_storage_stats erased = b.stats();
+	ASSERT_EQ(erased.live_elements, 15);
+	ASSERT_EQ(erased.allocated_blocks, 3);
+	ASSERT_EQ(erased.empty_blocks, 1);
+	ASSERT_EQ(erased.occupancy_histogram[0], 1);
+	ASSERT_EQ(erased.blocks_freed_total, 1);
+	ASSERT_EQ(erased.slot_capacity, b.capacity());
+
+	b.clear();
+	b.shrink_to_fit();
+	bucket_storage_stats cleared = b.stats();
+	ASSERT_EQ(cleared.allocated_blocks, 0);
+	ASSERT_EQ(cleared.blocks_allocated_total, cleared.blocks_freed_total);
+}
+#endif
+
+TYPED_TEST(base, empty_storage_allocation_free)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+	using bs_string_t = typename TestFixture::bs_string_t;
+
+	size_t before = this->allocations();
+	{
+		bs_string_t a;
+		bs_string_t b = std::move(a);
+		bs_string_t c(b);
+		bs_string_t d(32);
+		d = std::move(c);
+		d = b;
+		d.swap(b);
+		d.clear();
+		d.shrink_to_fit();
+		ASSERT_EQ(d.begin(), d.end());
+		ASSERT_EQ(b.capacity(), 0);
+	}
+	ASSERT_EQ(this->allocations(), before);
+
+	bs_sizet_t source;
+	source.insert(1);
+	source.insert(2);
+	bs_sizet_t target = std::move(source);
+	ASSERT_TRUE(source.empty());
+	ASSERT_EQ(source.begin(), source.end());
+	source.insert(3);
+	ASSERT_EQ(*source.begin(), 3);
+	ASSERT_EQ(std::accumulate(target.begin(), target.end(), size_t(0)), 3);
+
+	source.swap(target);
+	ASSERT_EQ(source.size(), 2);
+	ASSERT_EQ(*target.begin(), 3);
+	ASSERT_EQ(*std::prev(source.end()), 2);
+	ASSERT_EQ(*std::prev(target.end()), 3);
+}
+
+TYPED_TEST(base, steady_state_allocations)
 {
-	bs_co_t b = prepare();
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t();
+	for (size_t i = 0; i < 1000; ++i)
+		b.insert(i);
+
+	size_t before = this->allocations();
+	for (size_t i = 0; i < 1000; ++i)
+	{
+		b.erase(b.begin());
+		b.insert(i);
+	}
+	ASSERT_EQ(this->allocations(), before);
+
+	bs_sizet_t c = bs_sizet_t();
+	for (size_t i = 0; i < 64; ++i)
+		c.insert(i);
+	for (size_t i = 0; i < 64; ++i)
+		c.erase(c.begin());
+	before = this->allocations();
+	c.insert(0);
+	ASSERT_EQ(this->allocations(), before + 1);
+}
+
+TYPED_TEST(base, iterating)
+{
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
 	size_t n = b.size();
 	size_t counter = 0;
 	size_t sum = 0;
@@ -336,9 +1021,101 @@ TEST(base, iterating)
 	ASSERT_EQ(counter, b.size());
 }
 
-TEST(base, swap)
+TYPED_TEST(base, for_each_block)
 {
-	bs_co_t b = prepare();
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(16);
+	for (size_t i = 0; i < 1000; ++i)
+		b.insert(i);
+	for (typename bs_sizet_t::iterator it = b.begin(); it != b.end();)
+		it = *it % 4 == 1 ? b.erase(it) : std::next(it);
+	for (size_t i = 1000; i < 1100; ++i)
+		b.insert(i);
+
+	std::vector< size_t > visited;
+	b.for_each_block([&visited](size_t &value) { visited.push_back(value); });
+	std::vector< size_t > expected(b.begin(), b.end());
+
+	std::sort(visited.begin(), visited.end());
+	std::sort(expected.begin(), expected.end());
+	ASSERT_EQ(visited, expected);
+
+	const bs_sizet_t &cb = b;
+	size_t sum = 0;
+	cb.for_each_block([&sum](const size_t &value) { sum += value; });
+	ASSERT_EQ(sum, std::accumulate(expected.begin(), expected.end(), size_t(0)));
+}
+
+TYPED_TEST(base, for_each_block_wide_blocks)
+{
+	using bs_string_t = typename TestFixture::bs_string_t;
+
+	bs_string_t b = bs_string_t(130);
+	for (size_t i = 0; i < 1000; ++i)
+		b.insert(std::to_string(i));
+	for (typename bs_string_t::iterator it = b.begin(); it != b.end();)
+		it = std::stoul(*it) % 7 != 0 ? b.erase(it) : std::next(it);
+
+	std::vector< std::string > expected(b.begin(), b.end());
+	std::sort(expected.begin(), expected.end());
+	for (const bs_string_t &storage : { b, bs_string_t(b) })
+	{
+		std::vector< std::string > visited;
+		storage.for_each_block([&visited](const std::string &value) { visited.push_back(value); });
+		std::sort(visited.begin(), visited.end());
+		ASSERT_EQ(visited, expected);
+	}
+
+	b.clear();
+	b.insert("last");
+	size_t visits = 0;
+	b.for_each_block([&visits](std::string &value) { visits += value == "last"; });
+	ASSERT_EQ(visits, 1);
+}
+
+TYPED_TEST(base, parallel_for_each)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(16);
+	for (size_t i = 0; i < 5000; ++i)
+		b.insert(i);
+	for (typename bs_sizet_t::iterator it = b.begin(); it != b.end();)
+		it = *it % 3 == 0 ? b.erase(it) : std::next(it);
+	std::vector< size_t > expected(b.begin(), b.end());
+
+	for (size_t threads : { size_t(1), size_t(3), size_t(8), size_t(1000) })
+	{
+		b.parallel_for_each([](size_t &value) { value += 1; }, threads);
+		for (size_t &value : expected)
+			value += 1;
+		ASSERT_TRUE(std::equal(expected.begin(), expected.end(), b.begin(), b.end()));
+
+		const bs_sizet_t &cb = b;
+		std::atomic< size_t > visits = 0;
+		cb.parallel_for_each([&visits](const size_t &) { ++visits; }, threads);
+		ASSERT_EQ(visits, b.size());
+
+		const size_t sum = cb.parallel_reduce(
+			size_t(7),
+			[](size_t lhs, size_t rhs) { return lhs + rhs; },
+			[](const size_t &value) { return value * 2; },
+			threads);
+		ASSERT_EQ(sum, 7 + 2 * std::accumulate(expected.begin(), expected.end(), size_t(0)));
+	}
+
+	bs_sizet_t empty;
+	ASSERT_EQ(empty.parallel_reduce(size_t(5), std::plus<>(), [](size_t value) { return value; }, 4), 5);
+	ASSERT_THROW(b.parallel_for_each([](size_t &value) { if (value == 101) throw std::runtime_error("stop"); }, 4),
+				 std::runtime_error);
+}
+
+TYPED_TEST(base, swap)
+{
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
 	size_t n = b.size();
 
 	bs_co_t c = bs_co_t();
@@ -356,9 +1133,347 @@ TEST(base, swap)
 	ASSERT_EQ(e.size(), n);
 }
 
-TEST(coperators, simple_five_rule_count)
+TYPED_TEST(base, splice)
+{
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = bs_co_t(8);
+	bs_co_t c = bs_co_t(8);
+	for (size_t i = 0; i < 20; ++i)
+		b.insert(CountedOperationObject(i));
+	for (size_t i = 20; i < 50; ++i)
+		c.insert(CountedOperationObject(i));
+	erase_if(c, [](const CountedOperationObject &value) { return value.number % 3 == 0; });
+	typename bs_co_t::handle kept = b.get_handle(b.begin());
+	const size_t capacity = b.capacity() + c.capacity();
+	const size_t allocations = this->allocations();
+
+	opCount.clearCounters();
+	typename bs_co_t::iterator first = b.splice(std::move(c));
+	ASSERT_EQ(opCount, OpCount(0, 0, 0, 0, 0, 0));
+	ASSERT_EQ(this->allocations(), allocations + 2);
+	ASSERT_EQ(first->number, 20);
+	ASSERT_EQ(b.size(), 40);
+	ASSERT_EQ(b.capacity(), capacity);
+	ASSERT_TRUE(c.empty());
+	ASSERT_EQ(c.begin(), c.end());
+	ASSERT_EQ(*b.get(kept), *b.begin());
+
+	size_t expected = 0;
+	for (const CountedOperationObject &value : b)
+	{
+		while (expected >= 20 && expected % 3 == 0)
+			++expected;
+		ASSERT_EQ(value.number, expected++);
+	}
+	ASSERT_EQ(std::prev(b.end())->number, 49);
+	ASSERT_EQ(b.get_to_distance(b.begin(), 25)->number, 28);
+
+	typename bs_co_t::handle moved = b.get_handle(first);
+	ASSERT_EQ(b.get(moved)->number, 20);
+	erase_if(b, [](const CountedOperationObject &value) { return value.number < 30; });
+	ASSERT_EQ(b.get(moved), nullptr);
+	ASSERT_EQ(b.begin()->number, 31);
+	b.insert(CountedOperationObject(100));
+	ASSERT_EQ(b.size(), 14);
+
+	std::set< uint64_t > generations;
+	for (typename bs_co_t::const_iterator it = b.cbegin(); it != b.cend(); ++it)
+		ASSERT_TRUE(generations.insert(b.get_handle(it).generation).second);
+
+	c.insert(CountedOperationObject(200));
+	b.merge(c);
+	ASSERT_GT(b.get_handle(std::prev(b.cend())).generation, *generations.rbegin());
+	ASSERT_EQ(b.size(), 15);
+	ASSERT_EQ(std::prev(b.end())->number, 200);
+	ASSERT_EQ(b.splice(std::move(c)), b.end());
+}
+
+TYPED_TEST(base, snapshot)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+	using bs_string_t = typename TestFixture::bs_string_t;
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = bs_co_t(8);
+	for (size_t i = 0; i < 40; ++i)
+		b.insert(CountedOperationObject(i));
+	typename bs_co_t::handle h = b.get_handle(b.get_to_distance(b.begin(), 11));
+
+	opCount.clearCounters();
+	typename bs_co_t::snapshot_type view = b.snapshot();
+	ASSERT_EQ(opCount, NO_OP);
+	ASSERT_EQ(view.size(), 40);
+
+	b.erase(b.get_to_distance(b.begin(), 10));
+	ASSERT_EQ(opCount, OpCount(0, 8, 0, 0, 0, 1));
+	ASSERT_EQ(b.get(h)->number, 11);
+	b.insert(CountedOperationObject(100));
+	erase_if(b, [](const CountedOperationObject &value) { return value.number % 2 == 0; });
+	b.erase(b.begin(), std::next(b.begin(), 3));
+	ASSERT_EQ(b.size(), 17);
+	ASSERT_EQ(b.begin()->number, 7);
+	ASSERT_EQ(std::prev(b.end())->number, 39);
+	b.clear();
+
+	size_t expected = 0;
+	for (const CountedOperationObject &value : view)
+		ASSERT_EQ(value.number, expected++);
+	ASSERT_EQ(expected, 40);
+	size_t sum = 0;
+	view.for_each_block([&sum](const CountedOperationObject &value) { sum += value.number; });
+	ASSERT_EQ(sum, 780);
+
+	bs_sizet_t c = bs_sizet_t(4);
+	for (size_t i = 0; i < 40; ++i)
+		c.insert(i);
+	std::optional< typename bs_sizet_t::snapshot_type > first = c.snapshot();
+#if LABA3_BUCKET_STORAGE_STATS
+	const size_t allocated = c.stats().blocks_allocated_total;
+	c.erase(c.begin());
+	c.insert(40);
+	ASSERT_EQ(c.stats().blocks_allocated_total, allocated + 1);
+#endif
+	erase_if(c, [](size_t value) { return value % 4 != 0; });
+	std::optional< typename bs_sizet_t::snapshot_type > second = c.snapshot();
+	const size_t capacity = c.capacity();
+	c.shrink_to_fit();
+	ASSERT_EQ(c.capacity(), capacity);
+	ASSERT_EQ(c.defragment(100, [](typename bs_sizet_t::const_iterator, typename bs_sizet_t::iterator) {}), 0);
+	first.reset();
+	ASSERT_EQ(std::accumulate(second->begin(), second->end(), size_t(0)), std::accumulate(c.begin(), c.end(), size_t(0)));
+	second.reset();
+	c.shrink_to_fit();
+	ASSERT_EQ(c.capacity(), 12);
+
+	std::optional< typename bs_string_t::snapshot_type > strings;
+	{
+		bs_string_t s = bs_string_t(2);
+		s.insert("alpha");
+		s.insert("beta");
+		s.insert("gamma");
+		strings.emplace(s.snapshot());
+		s.erase(std::next(s.begin()));
+		s.insert("delta");
+	}
+	ASSERT_EQ(strings->size(), 3);
+	ASSERT_EQ(*strings->begin(), "alpha");
+	ASSERT_EQ(*std::next(strings->begin(), 1), "beta");
+	ASSERT_EQ(*std::next(strings->begin(), 2), "gamma");
+}
+
+TYPED_TEST(base, snapshot_in_place_writes)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(8);
+	for (size_t i = 0; i < 40; ++i)
+		b.insert(i);
+	const typename bs_sizet_t::handle h = b.get_handle(std::next(b.cbegin(), 20));
+	auto write_after_snapshot = [&b](auto write) {
+		const std::vector< size_t > before(b.cbegin(), b.cend());
+		typename bs_sizet_t::snapshot_type view = b.snapshot();
+		write();
+		return std::equal(view.begin(), view.end(), before.begin(), before.end()) && !std::equal(b.cbegin(), b.cend(), before.begin(), before.end());
+	};
+
+	ASSERT_TRUE(write_after_snapshot([&] { *b.get(h) = 1000; }));
+	ASSERT_TRUE(write_after_snapshot([&] { *b.writable(b.begin()) = 2000; }));
+	ASSERT_TRUE(write_after_snapshot([&] { *b.writable(std::prev(b.end())) = 3000; }));
+	ASSERT_TRUE(write_after_snapshot([&] { b.for_each_block([](size_t &value) { value += 1; }); }));
+	ASSERT_TRUE(write_after_snapshot([&] { b.parallel_for_each([](size_t &value) { value -= 1; }, 4); }));
+	ASSERT_TRUE(write_after_snapshot([&] { *b.writable(b.erase(b.begin())) = 4000; }));
+	ASSERT_EQ(*b.begin(), 4000);
+	ASSERT_EQ(*b.get(h), 1000);
+	ASSERT_EQ(b.size(), 39);
+	ASSERT_EQ(b.writable(b.end()), b.end());
+
+#if LABA3_BUCKET_STORAGE_STATS
+	const typename bs_sizet_t::snapshot_type view = b.snapshot();
+	const size_t allocated = b.stats().blocks_allocated_total;
+	size_t sum = 0;
+	for (size_t &value : b)
+		sum += value;
+	ASSERT_EQ(b.stats().blocks_allocated_total, allocated);
+	b.erase(std::find(b.begin(), b.end(), 30));
+	ASSERT_EQ(b.stats().blocks_allocated_total, allocated + 1);
+	ASSERT_EQ(std::accumulate(view.begin(), view.end(), size_t(0)), sum);
+#endif
+}
+
+TYPED_TEST(base, snapshot_move_assignment)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	static_assert(std::is_nothrow_move_assignable_v< typename bs_sizet_t::snapshot_type >);
+
+	bs_sizet_t b = bs_sizet_t(8);
+	std::vector< typename bs_sizet_t::snapshot_type > views;
+	for (size_t i = 0; i < 4; ++i)
+	{
+		b.insert_n(10, i);
+		views.push_back(b.snapshot());
+	}
+	views.erase(views.begin() + 1);
+	ASSERT_EQ(views.size(), 3);
+	ASSERT_EQ(views[0].size(), 10);
+	ASSERT_EQ(views[1].size(), 30);
+	ASSERT_EQ(views[2].size(), 40);
+	views[0] = std::move(views[2]);
+	ASSERT_EQ(views[0].size(), 40);
+	ASSERT_EQ(std::count(views[0].begin(), views[0].end(), 3), 10);
+}
+
+#if LABA3_BUCKET_STORAGE_MAPPING
+TYPED_TEST(base, save_load_mapped)
 {
-	bs_co_t b = prepare();
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	const std::string path = (std::filesystem::temp_directory_path() / "bucket_storage_save_load_mapped.bin").string();
+	bs_sizet_t b = bs_sizet_t(16);
+	b.set_max_block_capacity(64);
+	for (size_t i = 0; i < 500; ++i)
+		b.insert(i);
+	erase_if(b, [](size_t value) { return value % 3 == 0; });
+	b.insert(1000);
+	b.save(path);
+
+	bs_sizet_t first = bs_sizet_t::load_mapped(path);
+	bs_sizet_t second = bs_sizet_t::load_mapped(path);
+	ASSERT_TRUE(std::equal(b.begin(), b.end(), first.begin(), first.end()));
+	ASSERT_TRUE(std::equal(b.begin(), b.end(), second.begin(), second.end()));
+	ASSERT_EQ(first.capacity(), b.capacity());
+	ASSERT_EQ(first.max_block_capacity(), 64);
+	ASSERT_EQ(*first.get_to_distance(first.begin(), 100), *b.get_to_distance(b.begin(), 100));
+
+	typename bs_sizet_t::handle h = first.get_handle(first.insert(2000));
+	const size_t erased = erase_if(first, [](size_t value) { return value < 250; });
+	ASSERT_EQ(erased, 166);
+	first.insert_n(300, 7);
+	ASSERT_EQ(*first.get(h), 2000);
+	ASSERT_EQ(first.size(), b.size() - erased + 301);
+	bs_sizet_t copy = first;
+	first.shrink_to_fit();
+	ASSERT_EQ(first.size(), copy.size());
+	ASSERT_EQ(std::accumulate(first.begin(), first.end(), size_t(0)), std::accumulate(copy.begin(), copy.end(), size_t(0)));
+
+	bs_sizet_t third = bs_sizet_t::load_mapped(path);
+	ASSERT_TRUE(std::equal(b.begin(), b.end(), third.begin(), third.end()));
+	third.splice(std::move(second));
+	ASSERT_EQ(third.size(), 2 * b.size());
+	second = std::move(third);
+	ASSERT_EQ(std::accumulate(second.begin(), second.end(), size_t(0)), 2 * std::accumulate(b.begin(), b.end(), size_t(0)));
+
+	bs_sizet_t empty;
+	empty.save(path);
+	ASSERT_TRUE(bs_sizet_t::load_mapped(path).empty());
+
+	ASSERT_EQ(std::accumulate(second.begin(), second.end(), size_t(0)), 2 * std::accumulate(b.begin(), b.end(), size_t(0)));
+
+	typename bs_sizet_t::snapshot_type view = [&path, &b] {
+		b.save(path);
+		bs_sizet_t loaded = bs_sizet_t::load_mapped(path);
+		typename bs_sizet_t::snapshot_type result = loaded.snapshot();
+		erase_if(loaded, [](size_t value) { return value % 2 == 0; });
+		loaded.insert(3000);
+		return result;
+	}();
+	ASSERT_TRUE(std::equal(b.begin(), b.end(), view.begin(), view.end()));
+
+	std::filesystem::remove(path);
+	ASSERT_THROW(bs_sizet_t::load_mapped(path), std::system_error);
+	std::ofstream(path) << "garbage";
+	ASSERT_THROW(bs_sizet_t::load_mapped(path), std::runtime_error);
+	std::filesystem::remove(path);
+}
+
+TYPED_TEST(base, load_mapped_rejects_corruption)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	const std::string path = (std::filesystem::temp_directory_path() / "bucket_storage_corrupted.bin").string();
+	bs_sizet_t b = bs_sizet_t(16);
+	for (size_t i = 0; i < 40; ++i)
+		b.insert(i);
+	b.save(path);
+	std::ifstream file(path, std::ios::binary);
+	const std::vector< char > image((std::istreambuf_iterator< char >(file)), std::istreambuf_iterator< char >());
+	file.close();
+
+	using block = BlockNode< size_t >;
+	auto load_patched = [&path, &image](auto patch) {
+		// Copied into cache-line-aligned storage so that the block headers can be patched in place.
+		std::vector< aligned_chunk< cache_line_size > > chunks((image.size() + cache_line_size - 1) / cache_line_size);
+		char* bytes = reinterpret_cast< char* >(chunks.data());
+		std::memcpy(bytes, image.data(), image.size());
+		bucket_storage_file_block* directory = reinterpret_cast< bucket_storage_file_block* >(bytes + sizeof(bucket_storage_file_header));
+		patch(*directory, *reinterpret_cast< block* >(bytes + directory->offset));
+		std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes, static_cast< std::streamsize >(image.size()));
+		return bs_sizet_t::load_mapped(path).size();
+	};
+	ASSERT_EQ(load_patched([](bucket_storage_file_block&, block&) {}), 40);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block& entry, block&) { entry.capacity = 1 << 20; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block& entry, block&) { entry.capacity = 32; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.constructed = loaded.block_capacity + 1; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block& entry, block& loaded) {
+					 loaded.block_size = loaded.constructed + 1;
+					 entry.size = loaded.block_size;
+				 }),
+				 std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.occupancy()[0] &= ~uint64_t(1); }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.occupancy()[0] |= uint64_t(1) << 40; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.slots()[3].next = loaded.first_node; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.slots()[3].prev = loaded.slots() + 4; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.slots()[15].next = nullptr; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.first_node = nullptr; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.free_slots = loaded.last_node; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.slots()[5].position = 6; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.slots()[5].generation = 0; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block&, block& loaded) { loaded.index = 1; }), std::runtime_error);
+	ASSERT_THROW(load_patched([](bucket_storage_file_block& entry, block&) { entry.offset += 64; }), std::runtime_error);
+
+	auto load_header_patched = [&path, &image](auto patch) {
+		std::vector< char > bytes = image;
+		bucket_storage_file_header header;
+		std::memcpy(&header, bytes.data(), sizeof(header));
+		patch(header);
+		std::memcpy(bytes.data(), &header, sizeof(header));
+		std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), static_cast< std::streamsize >(bytes.size()));
+		return bs_sizet_t::load_mapped(path).size();
+	};
+	ASSERT_EQ(load_header_patched([](bucket_storage_file_header&) {}), 40);
+	ASSERT_THROW(load_header_patched([](bucket_storage_file_header& header) { header.size += 1; }), std::runtime_error);
+	ASSERT_THROW(load_header_patched([](bucket_storage_file_header& header) { header.block_capacity = 0; }), std::runtime_error);
+	ASSERT_THROW(load_header_patched([](bucket_storage_file_header& header) { header.block_capacity = uint64_t(1) << 33; }), std::runtime_error);
+	ASSERT_THROW(load_header_patched([](bucket_storage_file_header& header) { header.last_generation = 10; }), std::runtime_error);
+	std::filesystem::remove(path);
+}
+
+TYPED_TEST(base, load_mapped_rejects_truncated)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	const std::string path = (std::filesystem::temp_directory_path() / "bucket_storage_truncated.bin").string();
+	bs_sizet_t b = bs_sizet_t(16);
+	for (size_t i = 0; i < 40; ++i)
+		b.insert(i);
+	b.save(path);
+	const size_t length = std::filesystem::file_size(path);
+
+	for (size_t truncated : { length - 1, length / 2, sizeof(bucket_storage_file_header), sizeof(bucket_storage_file_header) - 1, size_t(0) })
+	{
+		std::filesystem::resize_file(path, truncated);
+		ASSERT_THROW(bs_sizet_t::load_mapped(path), std::runtime_error);
+	}
+	std::filesystem::remove(path);
+}
+#endif
+
+TYPED_TEST(coperators, simple_five_rule_count)
+{
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
 	size_t n = b.size();
 
 	bs_co_t c = b;
@@ -392,9 +1507,11 @@ TEST(coperators, simple_five_rule_count)
 	ASSERT_EQ(opCount, OpCount(n, 0, n, 0, n, n));
 }
 
-TEST(coperators, with_self)
+TYPED_TEST(coperators, with_self)
 {
-	bs_co_t b = prepare();
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
 	bs_co_t *volatile pb = &b;
 	b = *pb;
 	ASSERT_EQ(opCount, NO_OP);
@@ -404,40 +1521,160 @@ TEST(coperators, with_self)
 	ASSERT_EQ(opCount, NO_OP);
 }
 
-TEST(iterators, iter_const_eq)
+TYPED_TEST(coperators, copy_assignment_invalidates_handles)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_sizet_t b = bs_sizet_t(4);
+	bs_sizet_t c = bs_sizet_t(4);
+	std::vector< typename bs_sizet_t::handle > handles;
+	for (size_t i = 0; i < 8; ++i)
+	{
+		handles.push_back(b.get_handle(b.insert(i)));
+		c.insert(100 + i);
+	}
+	b = c;
+	ASSERT_TRUE(std::equal(b.begin(), b.end(), c.begin(), c.end()));
+	for (const typename bs_sizet_t::handle &h : handles)
+		ASSERT_EQ(b.get(h), nullptr);
+	ASSERT_EQ(*b.get(b.get_handle(b.begin())), 100);
+
+	bs_co_t d = bs_co_t(4);
+	bs_co_t e = bs_co_t(4);
+	std::vector< typename bs_co_t::handle > object_handles;
+	for (size_t i = 0; i < 8; ++i)
+	{
+		object_handles.push_back(d.get_handle(d.insert(CountedOperationObject(i))));
+		e.insert(CountedOperationObject(100 + i));
+	}
+	d = e;
+	for (const typename bs_co_t::handle &h : object_handles)
+		ASSERT_EQ(d.get(h), nullptr);
+	ASSERT_EQ(d.get(d.get_handle(d.begin()))->number, 100);
+}
+
+TYPED_TEST(coperators, copy_after_churn)
 {
-	bs_co_t b = prepare();
-	bs_co_t::iterator i = b.begin();
-	bs_co_t::const_iterator j = b.cbegin();
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(8);
+	for (size_t i = 0; i < 500; ++i)
+		b.insert(i);
+	for (typename bs_sizet_t::iterator it = b.begin(); it != b.end();)
+		it = (*it % 3 == 0 || (*it > 100 && *it < 180)) ? b.erase(it) : std::next(it);
+	for (size_t i = 0; i < 50; ++i)
+		b.insert(1000 + i);
+
+	bs_sizet_t c = b;
+	ASSERT_EQ(c.size(), b.size());
+	ASSERT_EQ(c.capacity(), b.capacity());
+	ASSERT_TRUE(std::equal(b.begin(), b.end(), c.begin(), c.end()));
+
+	const ptrdiff_t n = static_cast< ptrdiff_t >(c.size());
+	for (ptrdiff_t d = 0; d <= n; d += 5)
+		ASSERT_EQ(c.get_to_distance(c.begin(), d), std::next(c.begin(), d));
+
+	const std::vector< size_t > before(b.begin(), b.end());
+	for (typename bs_sizet_t::iterator it = c.begin(); it != c.end();)
+		it = (*it % 2 == 0) ? c.erase(it) : std::next(it);
+	for (size_t i = 0; i < 100; ++i)
+		c.insert(2000 + i);
+	ASSERT_TRUE(std::equal(before.begin(), before.end(), b.begin(), b.end()));
+	ASSERT_EQ(std::count(c.begin(), c.end(), 2050), 1);
+}
+
+TYPED_TEST(coperators, shrink_to_fit_moves)
+{
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
+	size_t n = b.size();
+	for (typename bs_co_t::iterator it = b.begin(); it != b.end();)
+		it = (it->number % 4 != 0) ? b.erase(it) : std::next(it);
+
+	opCount.clearCounters();
+	b.shrink_to_fit();
+	ASSERT_EQ(b.size(), n / 4);
+	ASSERT_EQ(b.capacity(), (n / 4 + 63) / 64 * 64);
+	ASSERT_EQ(opCount.ctorCount, 0);
+	ASSERT_EQ(opCount.mtorCount, opCount.dtorCount);
+
+	size_t seen = 0;
+	for (const CountedOperationObject &value : b)
+		seen += value.number % 4 == 0;
+	ASSERT_EQ(seen, n / 4);
+	ASSERT_EQ(std::distance(b.begin(), b.end()), static_cast< ptrdiff_t >(n / 4));
+	ASSERT_EQ(std::distance(b.get_to_distance(b.end(), -static_cast< ptrdiff_t >(n / 4)), b.end()), static_cast< ptrdiff_t >(n / 4));
+}
+
+TYPED_TEST(iterators, iter_const_eq)
+{
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
+	typename bs_co_t::iterator i = b.begin();
+	typename bs_co_t::const_iterator j = b.cbegin();
 
 	for (; i != b.cend() && j != b.end(); i++, j++)
 		ASSERT_EQ(i, j);
 	ASSERT_EQ(i, j);
 }
 
-TEST(iterators, comparision_lesseq)
+TYPED_TEST(iterators, comparision_lesseq)
 {
-	bs_co_t b = prepare();
-	for (bs_co_t::iterator it = b.begin(); it < b.end(); it++)
-		for (bs_co_t::iterator jt = it; jt < b.end(); jt++)
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
+	for (typename bs_co_t::iterator it = b.begin(); it < b.end(); it++)
+		for (typename bs_co_t::iterator jt = it; jt < b.end(); jt++)
 			ASSERT_TRUE(it <= jt);
 }
 
-TEST(iterators, comparision_lessge)
+TYPED_TEST(iterators, comparision_lessge)
 {
-	bs_co_t b = prepare();
-	for (bs_co_t::iterator it = b.begin(); it < b.end(); it++)
-		for (bs_co_t::iterator jt = it; jt < b.end(); jt++)
+	using bs_co_t = typename TestFixture::bs_co_t;
+
+	bs_co_t b = prepare< bs_co_t >();
+	for (typename bs_co_t::iterator it = b.begin(); it < b.end(); it++)
+		for (typename bs_co_t::iterator jt = it; jt < b.end(); jt++)
 			ASSERT_TRUE(jt >= it);
 }
 
-TEST(iterators, member_of_pointer)
+TYPED_TEST(iterators, comparision_after_churn)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(8);
+	for (size_t i = 0; i < 40; ++i)
+		b.insert(i);
+	erase_if(b, [](size_t value) { return value % 3 == 0; });
+	for (size_t i = 0; i < 10; ++i)
+		b.insert(100 + i);
+
+	for (typename bs_sizet_t::iterator it = b.begin(); it != b.end(); ++it)
+	{
+		ASSERT_TRUE(it < b.end());
+		ASSERT_FALSE(b.end() < it);
+		ASSERT_FALSE(it < it);
+		for (typename bs_sizet_t::iterator jt = std::next(it); jt != b.end(); ++jt)
+		{
+			ASSERT_TRUE(it < jt);
+			ASSERT_TRUE(jt > it);
+			ASSERT_FALSE(jt < it);
+		}
+	}
+}
+
+TYPED_TEST(iterators, member_of_pointer)
 {
+	using bs_string_t = typename TestFixture::bs_string_t;
+
 	bs_string_t b = bs_string_t();
 	for (size_t i = 0; i < 100; ++i)
 	{
 		std::string str = std::to_string(i);
-		bs_string_t::iterator it = b.insert(str);
+		typename bs_string_t::iterator it = b.insert(str);
 		ASSERT_EQ(b.size(), i + 1);
 
 		EXPECT_EQ(it->size(), str.size());
@@ -445,6 +1682,237 @@ TEST(iterators, member_of_pointer)
 	}
 }
 
+TYPED_TEST(iterators, get_to_distance_after_churn)
+{
+	using bs_sizet_t = typename TestFixture::bs_sizet_t;
+
+	bs_sizet_t b = bs_sizet_t(8);
+	for (size_t i = 0; i < 500; ++i)
+		b.insert(i);
+	for (typename bs_sizet_t::iterator it = b.begin(); it != b.end();)
+		it = (*it % 3 == 0 || (*it > 100 && *it < 180)) ? b.erase(it) : std::next(it);
+	for (size_t i = 0; i < 50; ++i)
+		b.insert(1000 + i);
+
+	const ptrdiff_t n = static_cast< ptrdiff_t >(b.size());
+	for (ptrdiff_t from = 0; from < n; from += 7)
+	{
+		typename bs_sizet_t::iterator start = std::next(b.begin(), from);
+		for (ptrdiff_t d = -from; d <= n - from; ++d)
+		{
+			typename bs_sizet_t::iterator expected = d < 0 ? std::prev(start, -d) : std::next(start, d);
+			ASSERT_EQ(b.get_to_distance(start, d), expected);
+		}
+	}
+	for (ptrdiff_t d = 1; d <= n; ++d)
+		ASSERT_EQ(b.get_to_distance(b.end(), -d), std::prev(b.end(), d));
+}
+
+TEST(allocators, counting_allocator_used)
+{
+	size_t before = CountingAllocator< char >::allocations;
+	size_t global_before = allocationCount;
+	{
+		bs_counting_t b;
+		for (size_t i = 0; i < 1000; ++i)
+			b.insert(i);
+		ASSERT_GT(CountingAllocator< char >::allocations, before);
+		ASSERT_GT(CountingAllocator< char >::liveAllocations, 0);
+	}
+	ASSERT_EQ(CountingAllocator< char >::liveAllocations, 0);
+	ASSERT_EQ(allocationCount - global_before, CountingAllocator< char >::allocations - before);
+}
+
+TEST(allocators, pmr_arena_only)
+{
+	std::vector< std::byte > buffer(1 << 20);
+	std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+	size_t before = allocationCount;
+	{
+		bs_pmr_t b(&arena);
+		for (size_t i = 0; i < 1000; ++i)
+			b.insert(i);
+		while (!b.empty())
+			b.erase(b.begin());
+		ASSERT_EQ(b.get_allocator().resource(), &arena);
+	}
+	ASSERT_EQ(allocationCount, before);
+}
+
+TEST(allocators, pmr_splice_across_resources)
+{
+	std::pmr::unsynchronized_pool_resource left_resource;
+	std::pmr::unsynchronized_pool_resource right_resource;
+	bs_pmr_t left(&left_resource);
+	bs_pmr_t right(&right_resource);
+	left.insert(1);
+	right.insert(2);
+	right.insert(3);
+	ASSERT_EQ(*left.splice(std::move(right)), 2);
+	ASSERT_EQ(left.size(), 3);
+	ASSERT_TRUE(right.empty());
+}
+
+TEST(allocators, pmr_snapshot_move_assignment)
+{
+	static_assert(std::is_nothrow_move_assignable_v< bs_pmr_t::snapshot_type >);
+
+	std::pmr::unsynchronized_pool_resource left_resource;
+	std::pmr::unsynchronized_pool_resource right_resource;
+	bs_pmr_t left(&left_resource);
+	bs_pmr_t right(&right_resource);
+	left.insert_n(20, 1);
+	right.insert_n(30, 2);
+	bs_pmr_t::snapshot_type view = left.snapshot();
+	view = right.snapshot();
+	right.clear();
+	ASSERT_EQ(view.size(), 30);
+	ASSERT_EQ(std::count(view.begin(), view.end(), 2), 30);
+}
+
+TEST(concurrent, insert_erase_stress)
+{
+	ConcurrentBucketStorage< size_t > storage(16);
+	const size_t threads = 8;
+	const size_t per_thread = 20000;
+	std::vector< std::vector< ConcurrentBucketStorage< size_t >::handle > > handles(threads);
+
+	std::vector< std::thread > workers;
+	for (size_t t = 0; t < threads; ++t)
+		workers.emplace_back(
+			[&, t]
+			{
+				for (size_t i = 0; i < per_thread; ++i)
+				{
+					ConcurrentBucketStorage< size_t >::handle h = storage.insert(t * per_thread + i);
+					if (i % 4 == 0)
+						storage.erase(h);
+					else
+						handles[t].push_back(h);
+				}
+			});
+	for (std::thread &worker : workers)
+		worker.join();
+	ASSERT_EQ(storage.size(), threads * per_thread * 3 / 4);
+
+	workers.clear();
+	for (size_t t = 0; t < threads; ++t)
+		workers.emplace_back(
+			[&, t]
+			{
+				const std::vector< ConcurrentBucketStorage< size_t >::handle > &victims = handles[(t + 1) % threads];
+				for (size_t i = 0; i < victims.size(); ++i)
+				{
+					if (i % 3 == 0)
+						storage.erase(victims[i]);
+					storage.insert(size_t(1) << 40);
+				}
+			});
+	for (std::thread &worker : workers)
+		worker.join();
+
+	size_t expected_sum = 0;
+	size_t expected_count = 0;
+	for (size_t t = 0; t < threads; ++t)
+		for (size_t i = 0; i < handles[t].size(); ++i)
+		{
+			expected_sum += (size_t(1) << 40) + (i % 3 == 0 ? 0 : *handles[t][i]);
+			expected_count += i % 3 == 0 ? 1 : 2;
+		}
+	size_t sum = 0;
+	size_t count = 0;
+	storage.for_each(
+		[&](size_t value)
+		{
+			sum += value;
+			++count;
+		});
+	ASSERT_EQ(count, expected_count);
+	ASSERT_EQ(storage.size(), expected_count);
+	ASSERT_EQ(sum, expected_sum);
+	ASSERT_LE(storage.capacity(), (expected_count + threads * 16) * 2);
+}
+
+TEST(concurrent, cross_thread_churn_reuses_slots)
+{
+	ConcurrentBucketStorage< size_t > storage(16);
+	const size_t threads = 4;
+	const size_t rounds = 2000;
+	std::mutex mailbox_mutex;
+	std::vector< std::vector< ConcurrentBucketStorage< size_t >::handle > > mailbox;
+
+	std::vector< std::thread > workers;
+	for (size_t t = 0; t < threads; ++t)
+		workers.emplace_back(
+			[&]
+			{
+				for (size_t round = 0; round < rounds; ++round)
+				{
+					std::vector< ConcurrentBucketStorage< size_t >::handle > batch;
+					for (size_t i = 0; i < 64; ++i)
+						batch.push_back(storage.insert(round));
+					{
+						std::lock_guard< std::mutex > lock(mailbox_mutex);
+						mailbox.push_back(std::move(batch));
+						batch = std::move(mailbox.front());
+						mailbox.erase(mailbox.begin());
+					}
+					for (const ConcurrentBucketStorage< size_t >::handle &h : batch)
+						storage.erase(h);
+				}
+			});
+	for (std::thread &worker : workers)
+		worker.join();
+
+	ASSERT_EQ(storage.size(), 0);
+	ASSERT_LE(storage.capacity(), 4096);
+}
+
+TEST(concurrent, exited_threads_return_blocks)
+{
+	ConcurrentBucketStorage< size_t > storage(16);
+	const size_t threads = 32;
+	std::atomic< size_t > inserted{ 0 };
+	std::vector< std::thread > workers;
+	for (size_t t = 0; t < threads; ++t)
+		workers.emplace_back(
+			[&storage, &inserted, t]
+			{
+				storage.insert(t);
+				++inserted;
+				while (inserted.load() != threads)
+					std::this_thread::yield();
+			});
+	for (std::thread &worker : workers)
+		worker.join();
+	ASSERT_EQ(storage.capacity(), threads * 16);
+
+	for (size_t i = 0; i < threads * 15; ++i)
+		storage.insert(i);
+	ASSERT_EQ(storage.size(), threads * 16);
+	ASSERT_EQ(storage.capacity(), threads * 16);
+}
+
+TEST(concurrent, alternating_storages_keep_their_blocks)
+{
+	std::vector< std::unique_ptr< ConcurrentBucketStorage< size_t > > > storages;
+	for (size_t i = 0; i < 6; ++i)
+		storages.push_back(std::make_unique< ConcurrentBucketStorage< size_t > >(16));
+	for (size_t round = 0; round < 64; ++round)
+		for (const std::unique_ptr< ConcurrentBucketStorage< size_t > > &storage : storages)
+			storage->insert(round);
+	for (const std::unique_ptr< ConcurrentBucketStorage< size_t > > &storage : storages)
+	{
+		ASSERT_EQ(storage->size(), 64);
+		ASSERT_EQ(storage->capacity(), 64);
+	}
+
+	storages.front() = std::make_unique< ConcurrentBucketStorage< size_t > >(16);
+	for (size_t i = 0; i < 16; ++i)
+		storages.front()->insert(i);
+	ASSERT_EQ(storages.front()->capacity(), 16);
+}
+
 int main(int argc, char **argv)
 {
 	::testing::InitGoogleTest();